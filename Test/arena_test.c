@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+
+#include "const.h"
+
+#define NO_MSGS 1000
+#define SMALL_LEN 16
+
+
+int main(int argc, char** argv){
+    int i;
+    int failures;
+    char msg[MAX_DATA_UNIT_SIZE];
+    char read_buf[MAX_DATA_UNIT_SIZE];
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    // TEST 1
+    printf("TEST 1: the arena can be enabled - ");
+    if (ioctl(fd, CHANGE_ARENA_CTL, 1) == 0 && ioctl(fd, GET_ARENA_CTL) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: small messages in the arena are charged with their length, as the others - ");
+    for (i=0 ; i<NO_MSGS ; i++){
+        memset(msg, i, SMALL_LEN);
+        write(fd, msg, SMALL_LEN);
+        }
+    if (MAX_STORAGE - ioctl(fd, GET_FREESPACE_SIZE_CTL) == NO_MSGS*SMALL_LEN && ioctl(fd, GET_ARENA_CHUNKS_CTL) > 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: messages are read back intact and the consumed chunks are released - ");
+    failures = 0;
+    for (i=0 ; i<NO_MSGS ; i++){
+        if (read(fd, read_buf, MAX_DATA_UNIT_SIZE) != SMALL_LEN || read_buf[0] != (char)i || read_buf[SMALL_LEN-1] != (char)i)
+            failures++;
+        }
+    if (failures == 0 && ioctl(fd, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE && ioctl(fd, GET_ARENA_CHUNKS_CTL) <= 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: large messages are charged with their length - ");
+    write(fd, msg, MAX_DATA_UNIT_SIZE);
+    if (ioctl(fd, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE - MAX_DATA_UNIT_SIZE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+
+    // TEST 5
+    printf("TEST 5: disabling the arena of an empty mailslot releases every chunk - ");
+    ioctl(fd, CHANGE_ARENA_CTL, 0);
+    if (ioctl(fd, GET_ARENA_CTL) == 0 && ioctl(fd, GET_ARENA_CHUNKS_CTL) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    close(fd);
+    }
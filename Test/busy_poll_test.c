@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "const.h"
+
+#define ROUNDS 10000
+
+int ping_fd;
+int pong_fd;
+
+void *pong_thread(void *args) {
+    int i;
+    char buf[MAX_DATA_UNIT_SIZE];
+
+    for (i=0 ; i<ROUNDS ; i++){
+        read(ping_fd, buf, MAX_DATA_UNIT_SIZE);
+        write(pong_fd, buf, 8);
+        }
+}
+
+//returns the average round trip time in nanoseconds
+long ping_pong(unsigned int busy_poll_usecs){
+    int i;
+    char buf[MAX_DATA_UNIT_SIZE];
+    struct timespec start, end;
+    pthread_t thread_pong;
+
+    ioctl(ping_fd, CHANGE_BUSY_POLL_CTL, busy_poll_usecs);
+    ioctl(pong_fd, CHANGE_BUSY_POLL_CTL, busy_poll_usecs);
+
+    if(pthread_create(&thread_pong, NULL, pong_thread, NULL)) {
+        fprintf(stderr, "Error creating thread\n");
+        exit(-1);
+        }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i=0 ; i<ROUNDS ; i++){
+        write(ping_fd, "pingpong", 8);
+        read(pong_fd, buf, MAX_DATA_UNIT_SIZE);
+        }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(pthread_join(thread_pong, NULL)) {
+        fprintf(stderr, "Error joining thread\n");
+        exit(-1);
+        }
+
+    return ((end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec) / ROUNDS;
+}
+
+
+int main(int argc, char** argv){
+    int ret;
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    char ping_path[80];
+    char pong_path[80];
+
+	if(argc!=4){
+		printf("you should pass MAJOR number and two MINOR numbers as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int ping_minor = atoi(argv[2]);
+	int pong_minor = atoi(argv[3]);
+
+    sprintf(ping_path,"/dev/mailslot%d", ping_minor);
+    sprintf(pong_path,"/dev/mailslot%d", pong_minor);
+
+	if( mknod(ping_path, S_IFCHR|0666, makedev(major, ping_minor)) == -1 && errno != EEXIST){
+        printf("ERROR in the creation of the file %s: %s\n", ping_path, strerror(errno));
+        return -1;
+        }
+	if( mknod(pong_path, S_IFCHR|0666, makedev(major, pong_minor)) == -1 && errno != EEXIST){
+        printf("ERROR in the creation of the file %s: %s\n", pong_path, strerror(errno));
+        return -1;
+        }
+
+	ping_fd = open(ping_path, 0666);
+	pong_fd = open(pong_path, 0666);
+
+	if(ping_fd == -1 || pong_fd == -1){
+		printf("ERROR while opening the files: %s\n", strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(ping_fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(ping_fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+    while(ioctl(pong_fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(pong_fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    // TEST 1
+    printf("TEST 1: busy poll budget above the limit - ");
+    ret = ioctl(ping_fd, CHANGE_BUSY_POLL_CTL, MAX_BUSY_POLL_USECS+1);
+    if (ret < 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: busy poll budget is per session - ");
+    ioctl(ping_fd, CHANGE_BUSY_POLL_CTL, 50);
+    if (ioctl(ping_fd, GET_BUSY_POLL_CTL) == 50 && ioctl(pong_fd, GET_BUSY_POLL_CTL) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    printf("average round trip without busy poll: %ld ns\n", ping_pong(0));
+    printf("average round trip with 50 usecs busy poll: %ld ns\n", ping_pong(50));
+
+    ioctl(ping_fd, CHANGE_BUSY_POLL_CTL, 0);
+    ioctl(pong_fd, CHANGE_BUSY_POLL_CTL, 0);
+
+    close(ping_fd);
+    close(pong_fd);
+    }
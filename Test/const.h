@@ -11,7 +11,119 @@
 #define GET_FREESPACE_SIZE_CTL 7
 #define GET_WRITE_BLOCKING_MODE_CTL 8
 #define GET_READ_BLOCKING_MODE_CTL 9
+#define CHANGE_SLOT_MODE_CTL 10
+#define GET_SLOT_MODE_CTL 11
+#define CHANGE_SLOW_SUBSCRIBER_POLICY_CTL 12
+#define GET_SLOW_SUBSCRIBER_POLICY_CTL 13
+#define GET_SUBSCRIBER_DROPPED_CTL 14
+#define CHANGE_BUSY_POLL_CTL 15
+#define GET_BUSY_POLL_CTL 16
+#define CHANGE_WRITE_BUSY_POLL_CTL 17
+#define GET_WRITE_BUSY_POLL_CTL 18
+#define CHANGE_READ_TIMEOUT_CTL 19
+#define GET_READ_TIMEOUT_CTL 20
+#define CHANGE_WRITE_TIMEOUT_CTL 21
+#define GET_WRITE_TIMEOUT_CTL 22
+#define CHANGE_SLOT_TTL_CTL 23
+#define GET_SLOT_TTL_CTL 24
+#define CHANGE_MESSAGE_TTL_CTL 25
+#define GET_MESSAGE_TTL_CTL 26
+#define GET_EXPIRED_CTL 27
+#define CHANGE_BACKPRESSURE_POLICY_CTL 28
+#define GET_BACKPRESSURE_POLICY_CTL 29
+#define GET_OVERWRITTEN_CTL 30
+#define CHANGE_SESSION_BYTE_QUOTA_CTL 31
+#define GET_SESSION_BYTE_QUOTA_CTL 32
+#define CHANGE_SESSION_MSG_QUOTA_CTL 33
+#define GET_SESSION_MSG_QUOTA_CTL 34
+#define GET_QUEUED_BYTES_CTL 35
+#define GET_QUEUED_MSGS_CTL 36
+#define GET_SESSION_STATS_CTL 37
+#define GROUP_RECEIVE_CTL 38
+#define REGISTER_EVENTFD_CTL 39
+#define UNREGISTER_EVENTFD_CTL 40
+#define CHANGE_CONSUMER_NODE_CTL 41
+#define GET_CONSUMER_NODE_CTL 42
+#define GET_NODE_STATS_CTL 43
+#define DRAIN_CTL 44
+#define SNAPSHOT_CTL 45
+#define RESTORE_CTL 46
+#define CHANGE_ARENA_CTL 47
+#define GET_ARENA_CTL 48
+#define GET_ARENA_CHUNKS_CTL 49
+#define CHANGE_SPSC_CTL 50
+#define GET_SPSC_CTL 51
+
+#define MAX_BUSY_POLL_USECS 10000
+
+#define FIFO_SLOT_MODE 0
+#define FANOUT_SLOT_MODE 1
+#define SHARDED_SLOT_MODE 2
+
+#define SLOW_SUBSCRIBER_BLOCK 0
+#define SLOW_SUBSCRIBER_DROP 1
+#define SLOW_SUBSCRIBER_DISCONNECT 2
+
+#define BACKPRESSURE_BLOCK 0
+#define BACKPRESSURE_OVERWRITE 1
+
+#define NOTIFY_NOT_EMPTY 1
+#define NOTIFY_SPACE 2
 
 #define N 8192
 
+struct fifomailslot_session_stats {
+    unsigned long msgs_written;
+    unsigned long bytes_written;
+    unsigned long msgs_read;
+    unsigned long bytes_read;
+};
+
+struct fifomailslot_eventfd {
+    int fd;
+    int events;
+    long watermark;
+};
+
+struct fifomailslot_node_stats {
+    int node;
+    unsigned long msgs;
+    unsigned long bytes;
+};
+
+#define FIFOMAILSLOT_DUMP_MAGIC 0x44534d46
+#define FIFOMAILSLOT_DUMP_VERSION 1
+#define FIFOMAILSLOT_DUMP_TRUNCATED 1
+
+struct fifomailslot_dump_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int flags;
+    unsigned int count;
+    unsigned int size;
+};
+
+struct fifomailslot_dump_record {
+    unsigned int len;
+};
+
+struct fifomailslot_dump {
+    char *buff;
+    size_t len;
+};
+
+struct fifomailslot_group_receive {
+    int *minors;
+    int no_minors;
+    char *buff;
+    size_t len;
+    int max_msgs;
+};
+
+struct fifomailslot_record {
+    int minor;
+    int len;
+};
+#define FIFOMAILSLOT_RECORD_SIZE(len) (sizeof(struct fifomailslot_record) + (((len) + 3) & ~3))
+
 #endif
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+
+#include "const.h"
+
+#define NO_MSGS 10
+#define MSG_LEN 16
+#define DUMP_SIZE (sizeof(struct fifomailslot_dump_header) + NO_MSGS*(sizeof(struct fifomailslot_dump_record) + MSG_LEN))
+
+
+int main(int argc, char** argv){
+    int ret;
+    int i;
+    int j;
+    int failures;
+    long freespace;
+    char msg[MAX_DATA_UNIT_SIZE];
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    char snapshot[DUMP_SIZE];
+    char drained[DUMP_SIZE];
+    struct fifomailslot_dump dump;
+    struct fifomailslot_dump_header header;
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    for (i=0 ; i<NO_MSGS ; i++){
+        memset(msg, 'a' + i, MSG_LEN);
+        write(fd, msg, MSG_LEN);
+        }
+    freespace = ioctl(fd, GET_FREESPACE_SIZE_CTL);
+
+    // TEST 1
+    printf("TEST 1: a snapshot exports every message and leaves them in the mailslot - ");
+    dump.buff = snapshot;
+    dump.len = DUMP_SIZE;
+    ret = ioctl(fd, SNAPSHOT_CTL, &dump);
+    memcpy(&header, snapshot, sizeof(header));
+    if (ret == DUMP_SIZE && header.magic == FIFOMAILSLOT_DUMP_MAGIC && header.count == NO_MSGS &&
+        header.flags == 0 && ioctl(fd, GET_FREESPACE_SIZE_CTL) == freespace)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: a drain into a small buffer is truncated - ");
+    dump.buff = drained;
+    dump.len = sizeof(struct fifomailslot_dump_header) + 3*(sizeof(struct fifomailslot_dump_record) + MSG_LEN);
+    ioctl(fd, DRAIN_CTL, &dump);
+    memcpy(&header, drained, sizeof(header));
+    if (header.count == 3 && (header.flags & FIFOMAILSLOT_DUMP_TRUNCATED))
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: a second drain empties the mailslot - ");
+    dump.len = DUMP_SIZE;
+    ioctl(fd, DRAIN_CTL, &dump);
+    memcpy(&header, drained, sizeof(header));
+    if (header.count == NO_MSGS - 3 && header.flags == 0 && ioctl(fd, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: a restored snapshot is read back in order - ");
+    dump.buff = snapshot;
+    dump.len = DUMP_SIZE;
+    failures = 0;
+    if (ioctl(fd, RESTORE_CTL, &dump) != NO_MSGS)
+        failures++;
+    for (i=0 ; i<NO_MSGS ; i++){
+        if (read(fd, read_buf, MAX_DATA_UNIT_SIZE) != MSG_LEN)
+            failures++;
+        for (j=0 ; j<MSG_LEN ; j++)
+            if (read_buf[j] != 'a' + i)
+                failures++;
+        }
+    if (failures == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 5
+    printf("TEST 5: a corrupted dump is refused and nothing is restored - ");
+    header.magic = 0;
+    memcpy(snapshot, &header, sizeof(header));
+    if (ioctl(fd, RESTORE_CTL, &dump) == -1 && errno == EINVAL && ioctl(fd, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    close(fd);
+    }
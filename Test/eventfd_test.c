@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+
+#include "const.h"
+
+#define WATERMARK (MAX_STORAGE/2)
+
+//returns the value accumulated on the eventfd, 0 if it was not signalled
+static uint64_t events_signalled(int efd){
+    uint64_t value;
+
+    if (read(efd, &value, sizeof(value)) != sizeof(value))
+        return 0;
+    return value;
+}
+
+
+int main(int argc, char** argv){
+    int i;
+    char msg[MAX_DATA_UNIT_SIZE];
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    struct fifomailslot_eventfd reg;
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    int efd = eventfd(0, EFD_NONBLOCK);
+
+    if(efd == -1){
+        printf("ERROR while creating the eventfd: %s\n", strerror(errno));
+        return -1;
+        }
+
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, 0);
+    ioctl(fd, CHANGE_READ_BLOCKING_MODE_CTL, 0);
+    while(read(fd, read_buf, MAX_DATA_UNIT_SIZE) != -1 || errno != EAGAIN);
+
+    memset(msg, 'a', MAX_DATA_UNIT_SIZE);
+    reg.fd = efd;
+    reg.events = NOTIFY_NOT_EMPTY;
+    reg.watermark = 0;
+
+    // TEST 1
+    printf("TEST 1: registering on an empty mailslot does not signal - ");
+    if (ioctl(fd, REGISTER_EVENTFD_CTL, &reg) == 0 && events_signalled(efd) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: a burst of writes is signalled once - ");
+    for (i=0 ; i<10 ; i++)
+        write(fd, msg, MAX_DATA_UNIT_SIZE);
+    if (events_signalled(efd) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: the event is armed again once the mailslot has been drained - ");
+    while(read(fd, read_buf, MAX_DATA_UNIT_SIZE) > 0);
+    write(fd, msg, MAX_DATA_UNIT_SIZE);
+    write(fd, msg, MAX_DATA_UNIT_SIZE);
+    if (events_signalled(efd) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: the free space reaching the watermark is signalled once - ");
+    reg.events = NOTIFY_SPACE;
+    reg.watermark = WATERMARK;
+    while(write(fd, msg, MAX_DATA_UNIT_SIZE) == MAX_DATA_UNIT_SIZE);
+    ioctl(fd, REGISTER_EVENTFD_CTL, &reg);
+    while(ioctl(fd, GET_FREESPACE_SIZE_CTL) < WATERMARK - MAX_DATA_UNIT_SIZE)
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    if (events_signalled(efd) == 0){
+        while(read(fd, read_buf, MAX_DATA_UNIT_SIZE) > 0);
+        if (events_signalled(efd) == 1)
+            printf("PASSED\n");
+        else
+            printf("NOT PASSED\n");
+        }
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 5
+    printf("TEST 5: an invalid watermark is refused - ");
+    reg.watermark = MAX_STORAGE + 1;
+    if (ioctl(fd, REGISTER_EVENTFD_CTL, &reg) == -1 && errno == EINVAL)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 6
+    printf("TEST 6: nothing is signalled after unregistering - ");
+    reg.events = NOTIFY_NOT_EMPTY;
+    ioctl(fd, REGISTER_EVENTFD_CTL, &reg);
+    ioctl(fd, UNREGISTER_EVENTFD_CTL);
+    write(fd, msg, MAX_DATA_UNIT_SIZE);
+    if (events_signalled(efd) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    while(read(fd, read_buf, MAX_DATA_UNIT_SIZE) > 0);
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, 1);
+    ioctl(fd, CHANGE_READ_BLOCKING_MODE_CTL, 1);
+
+    close(efd);
+    close(fd);
+    }
@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+#include <pthread.h>
+
+#include "const.h"
+
+int blocked_ret;
+
+//reads once from the session in arg, which is expected to block until the main thread writes
+void * blocked_read_thread(void* arg){
+    char buf[MAX_DATA_UNIT_SIZE];
+
+    blocked_ret = read(*(int*)arg, buf, MAX_DATA_UNIT_SIZE);
+    return NULL;
+}
+
+
+int main(int argc, char** argv){
+    int ret;
+    int i;
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    pthread_t reader;
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd_pub = open(pathname, O_WRONLY);
+	int fd_sub1 = open(pathname, O_RDONLY);
+	int fd_sub2 = open(pathname, O_RDONLY);
+
+	if(fd_pub == -1 || fd_sub1 == -1 || fd_sub2 == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    ioctl(fd_sub1, CHANGE_READ_BLOCKING_MODE_CTL, 0);
+    while(ioctl(fd_pub,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd_sub1, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    // TEST 1
+    printf("TEST 1: switch to fan-out mode - ");
+    ret = ioctl(fd_pub, CHANGE_SLOT_MODE_CTL, FANOUT_SLOT_MODE);
+    if (ret == 0 && ioctl(fd_pub, GET_SLOT_MODE_CTL) == FANOUT_SLOT_MODE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: a message is stored once for all the subscribers - ");
+    write(fd_pub, "test", 5);
+    if (ioctl(fd_pub, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE - 5)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: every subscriber reads the message - ");
+    ret = read(fd_sub1, read_buf, MAX_DATA_UNIT_SIZE);
+    if (ret == 5 && read(fd_sub2, read_buf, MAX_DATA_UNIT_SIZE) == 5)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: the storage is released after the last subscriber - ");
+    if (ioctl(fd_pub, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 5
+    printf("TEST 5: a slow subscriber loses its oldest messages with the drop policy - ");
+    ioctl(fd_pub, CHANGE_SLOW_SUBSCRIBER_POLICY_CTL, SLOW_SUBSCRIBER_DROP);
+    ioctl(fd_pub, CHANGE_WRITE_BLOCKING_MODE_CTL, 0);
+    for (i=0 ; i<MAX_STORAGE/MAX_DATA_UNIT_SIZE+1 ; i++){
+        write(fd_pub, read_buf, MAX_DATA_UNIT_SIZE);
+        read(fd_sub1, read_buf, MAX_DATA_UNIT_SIZE);
+        }
+    if (ioctl(fd_sub2, GET_SUBSCRIBER_DROPPED_CTL) == 1 && ioctl(fd_sub1, GET_SUBSCRIBER_DROPPED_CTL) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 6
+    printf("TEST 6: a slow subscriber is detached with the disconnect policy - ");
+    ioctl(fd_pub, CHANGE_SLOW_SUBSCRIBER_POLICY_CTL, SLOW_SUBSCRIBER_DISCONNECT);
+    write(fd_pub, read_buf, MAX_DATA_UNIT_SIZE);
+    read(fd_sub1, read_buf, MAX_DATA_UNIT_SIZE);
+    ret = read(fd_sub2, read_buf, MAX_DATA_UNIT_SIZE);
+    if (ret < 0 && errno == ECONNRESET)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd_pub, CHANGE_SLOW_SUBSCRIBER_POLICY_CTL, SLOW_SUBSCRIBER_BLOCK);
+    ioctl(fd_pub, CHANGE_WRITE_BLOCKING_MODE_CTL, 1);
+    ioctl(fd_sub1, CHANGE_READ_BLOCKING_MODE_CTL, 1);
+    ioctl(fd_pub, CHANGE_SLOT_MODE_CTL, FIFO_SLOT_MODE);
+
+    //a reader that never wakes up fails the test instead of hanging it
+    ioctl(fd_sub1, CHANGE_READ_TIMEOUT_CTL, 3000);
+
+    // TEST 7
+    printf("TEST 7: a reader blocked before the switch to fan-out gets the next message - ");
+    blocked_ret = 0;
+    pthread_create(&reader, NULL, blocked_read_thread, (void*)&fd_sub1);
+    sleep(1);
+    ioctl(fd_pub, CHANGE_SLOT_MODE_CTL, FANOUT_SLOT_MODE);
+    write(fd_pub, "test", 5);
+    pthread_join(reader, NULL);
+    if (blocked_ret == 5)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 8
+    printf("TEST 8: a subscriber blocked before the switch back to FIFO gets the next message - ");
+    blocked_ret = 0;
+    pthread_create(&reader, NULL, blocked_read_thread, (void*)&fd_sub1);
+    sleep(1);
+    ioctl(fd_pub, CHANGE_SLOT_MODE_CTL, FIFO_SLOT_MODE);
+    write(fd_pub, "test", 5);
+    pthread_join(reader, NULL);
+    if (blocked_ret == 5)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd_sub1, CHANGE_READ_TIMEOUT_CTL, 0);
+
+    close(fd_sub2);
+    close(fd_sub1);
+    close(fd_pub);
+    }
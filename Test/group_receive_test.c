@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+#include <pthread.h>
+
+#include "const.h"
+
+#define SLOTS 3
+
+int fds[SLOTS];
+
+void *write_thread(void *args) {
+    sleep(5);
+    write(fds[SLOTS-1], "late", 5);
+}
+
+
+int main(int argc, char** argv){
+    int ret;
+    int i;
+    int ok;
+    int minors[SLOTS];
+    char pathname[80];
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    char group_buf[4096];
+    struct fifomailslot_group_receive req;
+    struct fifomailslot_record *record;
+    struct fifomailslot_session_stats before, after;
+    pthread_t thread_write;
+
+	if(argc!=2+SLOTS){
+		printf("you should pass MAJOR number and %d MINOR numbers as parameters\n", SLOTS);
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+
+    for (i=0 ; i<SLOTS ; i++){
+        minors[i] = atoi(argv[2+i]);
+        sprintf(pathname,"/dev/mailslot%d", minors[i]);
+        if( mknod(pathname, S_IFCHR|0666, makedev(major, minors[i])) == -1 && errno != EEXIST){
+            printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+            return -1;
+            }
+        fds[i] = open(pathname, 0666);
+        if(fds[i] == -1){
+            printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+            return -1;
+            }
+        while(ioctl(fds[i],GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+            read(fds[i], read_buf, MAX_DATA_UNIT_SIZE);
+            }
+        }
+
+    req.minors = minors;
+    req.no_minors = SLOTS;
+    req.buff = group_buf;
+    req.len = sizeof(group_buf);
+
+    // TEST 1
+    printf("TEST 1: messages of different slots are received in one call - ");
+    write(fds[0], "a1", 3);
+    write(fds[0], "a2", 3);
+    write(fds[1], "b1", 3);
+    req.max_msgs = 16;
+    ret = ioctl(fds[0], GROUP_RECEIVE_CTL, &req);
+    if (ret == 3)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: the slots are served round robin and every record is tagged - ");
+    record = (struct fifomailslot_record *)group_buf;
+    ok = record->minor == minors[0] && strcmp((char *)(record+1), "a1") == 0;
+    record = (struct fifomailslot_record *)((char *)record + FIFOMAILSLOT_RECORD_SIZE(record->len));
+    ok = ok && record->minor == minors[1] && strcmp((char *)(record+1), "b1") == 0;
+    record = (struct fifomailslot_record *)((char *)record + FIFOMAILSLOT_RECORD_SIZE(record->len));
+    ok = ok && record->minor == minors[0] && strcmp((char *)(record+1), "a2") == 0;
+    if (ok)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: no more than max_msgs messages are received - ");
+    write(fds[0], "a3", 3);
+    write(fds[1], "b2", 3);
+    req.max_msgs = 1;
+    ret = ioctl(fds[0], GROUP_RECEIVE_CTL, &req);
+    req.max_msgs = 16;
+    if (ret == 1 && ioctl(fds[0], GROUP_RECEIVE_CTL, &req) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: group receive blocks until any slot has a message - ");
+    if(pthread_create(&thread_write, NULL, write_thread, NULL)) {
+        fprintf(stderr, "Error creating thread\n");
+        return -1;
+        }
+    ret = ioctl(fds[0], GROUP_RECEIVE_CTL, &req);
+    record = (struct fifomailslot_record *)group_buf;
+    if (ret == 1 && record->minor == minors[SLOTS-1])
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    if(pthread_join(thread_write, NULL)) {
+        fprintf(stderr, "Error joining thread\n");
+        return -1;
+        }
+
+    // TEST 5
+    printf("TEST 5: the session statistics count the payload of the records, not their headers - ");
+    write(fds[0], "a4", 3);
+    write(fds[1], "b3", 3);
+    ioctl(fds[0], GET_SESSION_STATS_CTL, &before);
+    ret = ioctl(fds[0], GROUP_RECEIVE_CTL, &req);
+    ioctl(fds[0], GET_SESSION_STATS_CTL, &after);
+    if (ret == 2 && after.msgs_read - before.msgs_read == 2 && after.bytes_read - before.bytes_read == 6)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    for (i=0 ; i<SLOTS ; i++)
+        close(fds[i]);
+    }
@@ -0,0 +1,139 @@
+/*
+ * Exercises the in-kernel API of the mail slot module: the slot is looked up by minor, written from
+ * process context and from softirq context (a timer, with GFP_ATOMIC) and read back from process
+ * context, where fifomailslot_kernel_read() has to be called. The tests run when the module is
+ * loaded and print their result to the kernel log:
+ *
+ *     insmod kernel_api_test.ko minor=MINOR && rmmod kernel_api_test && dmesg | grep kernel_api_test
+ *
+ * The slot should not be used by anybody else while the tests run, it is emptied at the start.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/timer.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+#include <linux/string.h>
+#include <linux/preempt.h>
+
+#include "linux_mail_slot_api.h"
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("tests of the in-kernel API of the mail slot");
+
+#define TEST_NAME "kernel_api_test"
+#define NO_MSGS 10
+#define MSG_LEN 16
+#define OVERSIZED_LEN PAGE_SIZE
+#define DELIVERY_TIMEOUT_MSECS 1000
+
+static int minor = 0;
+module_param(minor, int, 0444);
+MODULE_PARM_DESC(minor, "minor number of the mail slot to test, it is emptied");
+
+static struct fifomailslot_dev *dev;
+static struct timer_list softirq_timer;
+static DECLARE_COMPLETION(softirq_done);
+static int softirq_written;
+static int softirq_context;
+
+static void fill_message(char *msg, int i){
+    memset(msg, 'a' + i % 26, MSG_LEN);
+}
+
+static void report(int test, const char *what, int passed){
+    printk(KERN_INFO "%s: TEST %d (%s): %s\n", TEST_NAME, test, what, passed ? "PASSED" : "NOT PASSED");
+}
+
+//the messages a softirq writes are linked by a work item, they show up shortly after the write
+static int read_message(char *buf, size_t len){
+    int waited = 0;
+    ssize_t ret;
+
+    while ((ret = fifomailslot_kernel_read(dev, buf, len)) == -EAGAIN && waited < DELIVERY_TIMEOUT_MSECS){
+        msleep(10);
+        waited += 10;
+    }
+    return ret;
+}
+
+static void softirq_write(struct timer_list *timer){
+    int i;
+    char msg[MSG_LEN];
+    struct fifomailslot_dev *slot;
+
+    softirq_context = in_softirq();
+    //the lookup is lockless and valid in any context
+    slot = fifomailslot_lookup(minor);
+    for (i=0 ; slot && i<NO_MSGS ; i++){
+        fill_message(msg, i);
+        if (fifomailslot_kernel_write(slot, msg, MSG_LEN, GFP_ATOMIC) == MSG_LEN)
+            softirq_written++;
+    }
+    complete(&softirq_done);
+}
+
+static int __init kernel_api_test_init(void){
+    int i;
+    int failures;
+    char msg[MSG_LEN];
+    char read_buf[MSG_LEN];
+    char *oversized;
+    ssize_t ret;
+
+    printk(KERN_INFO "%s: testing the mail slot with minor number %d\n", TEST_NAME, minor);
+
+    //TEST 1: a slot is found by its minor, an invalid minor finds nothing
+    dev = fifomailslot_lookup(minor);
+    report(1, "lookup", dev != NULL && fifomailslot_lookup(-1) == NULL);
+    if (!dev)
+        return -ENODEV;
+
+    while (fifomailslot_kernel_read(dev, read_buf, MSG_LEN) > 0);
+
+    //TEST 2: messages written from process context are queued before the write returns
+    failures = 0;
+    for (i=0 ; i<NO_MSGS ; i++){
+        fill_message(msg, i);
+        if (fifomailslot_kernel_write(dev, msg, MSG_LEN, GFP_KERNEL) != MSG_LEN)
+            failures++;
+    }
+    for (i=0 ; i<NO_MSGS ; i++){
+        fill_message(msg, i);
+        ret = fifomailslot_kernel_read(dev, read_buf, MSG_LEN);
+        if (ret != MSG_LEN || memcmp(msg, read_buf, MSG_LEN))
+            failures++;
+    }
+    report(2, "write and read from process context", failures == 0);
+
+    //TEST 3: messages written from softirq context are read in the order of the writes
+    timer_setup(&softirq_timer, softirq_write, 0);
+    mod_timer(&softirq_timer, jiffies + 1);
+    wait_for_completion(&softirq_done);
+    del_timer_sync(&softirq_timer);
+    failures = softirq_context && softirq_written == NO_MSGS ? 0 : 1;
+    for (i=0 ; i<softirq_written ; i++){
+        fill_message(msg, i);
+        ret = read_message(read_buf, MSG_LEN);
+        if (ret != MSG_LEN || memcmp(msg, read_buf, MSG_LEN))
+            failures++;
+    }
+    report(3, "write from softirq context, read from process context", failures == 0);
+
+    //TEST 4: an empty slot and an oversized message are reported as a user read and write would
+    oversized = kzalloc(OVERSIZED_LEN, GFP_KERNEL);
+    ret = oversized ? fifomailslot_kernel_write(dev, oversized, OVERSIZED_LEN, GFP_KERNEL) : -EMSGSIZE;
+    kfree(oversized);
+    report(4, "empty slot and oversized message",
+           fifomailslot_kernel_read(dev, read_buf, MSG_LEN) == -EAGAIN && ret == -EMSGSIZE);
+
+    return 0;
+}
+
+static void __exit kernel_api_test_exit(void){
+    printk(KERN_INFO "%s: removed\n", TEST_NAME);
+}
+
+module_init(kernel_api_test_init);
+module_exit(kernel_api_test_exit);
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+
+#include "const.h"
+
+#define NO_MSGS 100
+
+
+int main(int argc, char** argv){
+    int i;
+    int node;
+    unsigned long msgs;
+    char msg[MAX_DATA_UNIT_SIZE];
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    struct fifomailslot_node_stats stats;
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    memset(msg, 'a', MAX_DATA_UNIT_SIZE);
+
+    // TEST 1
+    printf("TEST 1: the slot starts with a valid consumer node - ");
+    node = ioctl(fd, GET_CONSUMER_NODE_CTL);
+    if (node >= 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: an offline node is refused - ");
+    if (ioctl(fd, CHANGE_CONSUMER_NODE_CTL, 1<<20) == -1 && errno == EINVAL)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: the messages are allocated on the consumer node set by ioctl - ");
+    ioctl(fd, CHANGE_CONSUMER_NODE_CTL, 0);
+    stats.node = 0;
+    ioctl(fd, GET_NODE_STATS_CTL, &stats);
+    msgs = stats.msgs;
+    for (i=0 ; i<NO_MSGS ; i++)
+        write(fd, msg, MAX_DATA_UNIT_SIZE);
+    ioctl(fd, GET_NODE_STATS_CTL, &stats);
+    if (ioctl(fd, GET_CONSUMER_NODE_CTL) == 0 && stats.msgs == msgs + NO_MSGS)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: statistics of a node that does not exist are refused - ");
+    stats.node = -1;
+    if (ioctl(fd, GET_NODE_STATS_CTL, &stats) == -1 && errno == EINVAL)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 5
+    printf("TEST 5: a tracked consumer node follows the reader - ");
+    ioctl(fd, CHANGE_CONSUMER_NODE_CTL, -1);
+    for (i=0 ; i<NO_MSGS ; i++)
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    if (ioctl(fd, GET_CONSUMER_NODE_CTL) >= 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    close(fd);
+    }
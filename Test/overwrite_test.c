@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+
+#include "const.h"
+
+#define SLOT_MESSAGES (MAX_STORAGE/MAX_DATA_UNIT_SIZE)
+
+
+int main(int argc, char** argv){
+    int ret;
+    int i;
+    int failures;
+    long overwritten;
+    char msg[MAX_DATA_UNIT_SIZE];
+    char read_buf[MAX_DATA_UNIT_SIZE];
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    ioctl(fd, CHANGE_BACKPRESSURE_POLICY_CTL, BACKPRESSURE_OVERWRITE);
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, 0);
+    overwritten = ioctl(fd, GET_OVERWRITTEN_CTL);
+
+    // TEST 1
+    printf("TEST 1: writes on a full lossy mailslot never fail - ");
+    failures = 0;
+    for (i=0 ; i<2*SLOT_MESSAGES ; i++){
+        memcpy(msg, &i, sizeof(i));
+        if (write(fd, msg, MAX_DATA_UNIT_SIZE) != MAX_DATA_UNIT_SIZE)
+            failures++;
+        }
+    if (failures == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: the oldest messages are counted as overwritten - ");
+    if (ioctl(fd, GET_OVERWRITTEN_CTL) == overwritten + SLOT_MESSAGES)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: the newest messages survive - ");
+    ret = read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    memcpy(&i, read_buf, sizeof(i));
+    if (ret == MAX_DATA_UNIT_SIZE && i == SLOT_MESSAGES)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd, CHANGE_BACKPRESSURE_POLICY_CTL, BACKPRESSURE_BLOCK);
+    ioctl(fd, CHANGE_WRITE_BLOCKING_MODE_CTL, 1);
+
+    while(ioctl(fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    close(fd);
+    }
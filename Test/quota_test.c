@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+
+#include "const.h"
+
+
+int main(int argc, char** argv){
+    int ret;
+    char read_buf[MAX_DATA_UNIT_SIZE];
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd_noisy = open(pathname, 0666);
+	int fd_quiet = open(pathname, 0666);
+
+	if(fd_noisy == -1 || fd_quiet == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(fd_noisy,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd_noisy, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    ioctl(fd_noisy, CHANGE_WRITE_BLOCKING_MODE_CTL, 0);
+    ioctl(fd_noisy, CHANGE_SESSION_MSG_QUOTA_CTL, 2);
+
+    // TEST 1
+    printf("TEST 1: a session cannot go beyond the message quota - ");
+    write(fd_noisy, "test", 5);
+    write(fd_noisy, "test", 5);
+    ret = write(fd_noisy, "test", 5);
+    if (ret < 0 && errno == EAGAIN && ioctl(fd_noisy, GET_QUEUED_MSGS_CTL) == 2)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: the quota of a session does not affect the others - ");
+    ret = write(fd_quiet, "test", 5);
+    if (ret == 5 && ioctl(fd_quiet, GET_QUEUED_BYTES_CTL) == 5)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: consumed messages give the quota back - ");
+    read(fd_quiet, read_buf, MAX_DATA_UNIT_SIZE);
+    ret = write(fd_noisy, "test", 5);
+    if (ret == 5 && ioctl(fd_noisy, GET_QUEUED_MSGS_CTL) == 2)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: a session cannot go beyond the byte quota - ");
+    ioctl(fd_noisy, CHANGE_SESSION_MSG_QUOTA_CTL, 0);
+    ioctl(fd_noisy, CHANGE_SESSION_BYTE_QUOTA_CTL, 12);
+    ret = write(fd_noisy, "test", 5);
+    if (ret < 0 && errno == EAGAIN && ioctl(fd_noisy, GET_QUEUED_BYTES_CTL) == 10)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd_noisy, CHANGE_SESSION_BYTE_QUOTA_CTL, 0);
+    ioctl(fd_noisy, CHANGE_WRITE_BLOCKING_MODE_CTL, 1);
+
+    while(ioctl(fd_noisy,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd_noisy, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    close(fd_quiet);
+    close(fd_noisy);
+    }
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+
+#include "const.h"
+
+
+int main(int argc, char** argv){
+    int ret;
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    struct fifomailslot_session_stats stats;
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd1 = open(pathname, 0666);
+	int fd2 = open(pathname, 0666);
+	int fd_nonblock = open(pathname, O_RDWR|O_NONBLOCK);
+
+	if(fd1 == -1 || fd2 == -1 || fd_nonblock == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(fd1,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd_nonblock, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    // TEST 1
+    printf("TEST 1: blocking modes are per session - ");
+    ioctl(fd1, CHANGE_READ_BLOCKING_MODE_CTL, 0);
+    if (ioctl(fd1, GET_READ_BLOCKING_MODE_CTL) == 0 && ioctl(fd2, GET_READ_BLOCKING_MODE_CTL) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: maximum data unit size is per session - ");
+    ioctl(fd1, CHANGE_MAX_DATA_UNIT_SIZE_CTL, 2);
+    ret = write(fd2, "test", 5);
+    if (ret == 5 && write(fd1, "test", 5) < 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: O_NONBLOCK sessions do not block on an empty mailslot - ");
+    read(fd1, read_buf, MAX_DATA_UNIT_SIZE);
+    ret = read(fd_nonblock, read_buf, MAX_DATA_UNIT_SIZE);
+    if (ret < 0 && errno == EAGAIN)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: every session counts its own messages - ");
+    ioctl(fd2, GET_SESSION_STATS_CTL, &stats);
+    ret = stats.msgs_written == 1 && stats.bytes_written == 5 && stats.msgs_read == 0;
+    ioctl(fd1, GET_SESSION_STATS_CTL, &stats);
+    if (ret && stats.msgs_written == 0 && stats.msgs_read == 1 && stats.bytes_read == 5)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    close(fd_nonblock);
+    close(fd2);
+    close(fd1);
+    }
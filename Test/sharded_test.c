@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+#include <pthread.h>
+
+#include "const.h"
+
+#define PRODUCERS 8
+#define MESSAGES 1000
+
+struct message {
+    int producer;
+    int seq;
+};
+
+char pathname[80];
+
+void *write_thread(void *args) {
+    int i;
+    struct message msg;
+    //every producer has its own session, the order is kept only inside a session
+    int fd = open(pathname, O_WRONLY);
+
+    msg.producer = *(int*)args;
+    for (i=0 ; i<MESSAGES ; i++){
+        msg.seq = i;
+        write(fd, &msg, sizeof(msg));
+        }
+    close(fd);
+}
+
+
+int main(int argc, char** argv){
+    int ret;
+    int i;
+    int ids[PRODUCERS];
+    int next_seq[PRODUCERS];
+    int out_of_order;
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    struct message msg;
+    pthread_t thread_write[PRODUCERS];
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    // TEST 1
+    printf("TEST 1: switch to sharded mode - ");
+    ret = ioctl(fd, CHANGE_SLOT_MODE_CTL, SHARDED_SLOT_MODE);
+    if (ret == 0 && ioctl(fd, GET_SLOT_MODE_CTL) == SHARDED_SLOT_MODE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    for (i=0 ; i<PRODUCERS ; i++){
+        ids[i] = i;
+        next_seq[i] = 0;
+        if(pthread_create(&thread_write[i], NULL, write_thread, (void*)&ids[i])) {
+            fprintf(stderr, "Error creating thread\n");
+            return -1;
+            }
+        }
+
+    for (i=0 ; i<PRODUCERS ; i++){
+        if(pthread_join(thread_write[i], NULL)) {
+            fprintf(stderr, "Error joining thread\n");
+            return -1;
+            }
+        }
+
+    // TEST 2
+    printf("TEST 2: all the messages are stored - ");
+    if (ioctl(fd, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE - PRODUCERS*MESSAGES*sizeof(msg))
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: the messages of every producer are read in order - ");
+    out_of_order = 0;
+    for (i=0 ; i<PRODUCERS*MESSAGES ; i++){
+        ret = read(fd, &msg, sizeof(msg));
+        if (ret != sizeof(msg) || msg.seq != next_seq[msg.producer]++)
+            out_of_order++;
+        }
+    if (out_of_order == 0 && ioctl(fd, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd, CHANGE_SLOT_MODE_CTL, FIFO_SLOT_MODE);
+
+    close(fd);
+    }
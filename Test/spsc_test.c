@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+#include <pthread.h>
+
+#include "const.h"
+
+#define NO_MSGS 1000
+
+void *write_thread(void *args) {
+    sleep(2);
+    int fd = *(int*)args;
+    write(fd, "test", 5);
+}
+
+
+int main(int argc, char** argv){
+    int i;
+    int failures;
+    int fd_third;
+    char msg[MAX_DATA_UNIT_SIZE];
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    pthread_t thread_write;
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd_write = open(pathname, O_WRONLY);
+	int fd_read = open(pathname, O_RDONLY);
+
+	if(fd_write == -1 || fd_read == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    ioctl(fd_read, CHANGE_READ_BLOCKING_MODE_CTL, 0);
+    while(ioctl(fd_read,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd_read, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    // TEST 1
+    printf("TEST 1: a slot with one writer and one reader session switches to the ring - ");
+    if (ioctl(fd_read, GET_SPSC_CTL) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: messages go through the ring in order and their space is accounted - ");
+    for (i=0 ; i<NO_MSGS ; i++){
+        memset(msg, i, MAX_DATA_UNIT_SIZE);
+        write(fd_write, msg, (i % MAX_DATA_UNIT_SIZE) + 1);
+        }
+    failures = ioctl(fd_read, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE ? 1 : 0;
+    for (i=0 ; i<NO_MSGS ; i++){
+        if (read(fd_read, read_buf, MAX_DATA_UNIT_SIZE) != (i % MAX_DATA_UNIT_SIZE) + 1 || read_buf[0] != (char)i)
+            failures++;
+        }
+    if (failures == 0 && ioctl(fd_read, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: a non blocking read on the empty ring fails with EAGAIN - ");
+    if (read(fd_read, read_buf, MAX_DATA_UNIT_SIZE) == -1 && errno == EAGAIN)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: a reader blocked on the empty ring is woken up by the first write - ");
+    ioctl(fd_read, CHANGE_READ_BLOCKING_MODE_CTL, 1);
+    if(pthread_create(&thread_write, NULL, write_thread, (void*)&fd_write)) {
+        fprintf(stderr, "Error creating thread\n");
+        return -1;
+        }
+    if (read(fd_read, read_buf, MAX_DATA_UNIT_SIZE) == 5 && strcmp(read_buf, "test") == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+    if(pthread_join(thread_write, NULL)) {
+        fprintf(stderr, "Error joining thread\n");
+        return -1;
+        }
+    ioctl(fd_read, CHANGE_READ_BLOCKING_MODE_CTL, 0);
+
+    // TEST 5
+    printf("TEST 5: a third session switches the slot back to the queue keeping the messages in order - ");
+    for (i=0 ; i<10 ; i++){
+        memset(msg, i, MAX_DATA_UNIT_SIZE);
+        write(fd_write, msg, MAX_DATA_UNIT_SIZE);
+        }
+    fd_third = open(pathname, O_RDONLY);
+    failures = ioctl(fd_read, GET_SPSC_CTL) == 0 ? 0 : 1;
+    for (i=0 ; i<10 ; i++){
+        if (read(fd_read, read_buf, MAX_DATA_UNIT_SIZE) != MAX_DATA_UNIT_SIZE || read_buf[0] != (char)i)
+            failures++;
+        }
+    if (failures == 0 && ioctl(fd_read, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 6
+    printf("TEST 6: closing the third session switches the slot to the ring again - ");
+    close(fd_third);
+    if (ioctl(fd_read, GET_SPSC_CTL) == 1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 7
+    printf("TEST 7: a session writing and reading gets the ring only when asked by ioctl - ");
+    close(fd_write);
+    close(fd_read);
+    fd_third = open(pathname, O_RDWR);
+    failures = ioctl(fd_third, GET_SPSC_CTL) == 0 ? 0 : 1;
+    ioctl(fd_third, CHANGE_SPSC_CTL, 1);
+    if (ioctl(fd_third, GET_SPSC_CTL) != 1)
+        failures++;
+    write(fd_third, "test", 5);
+    if (read(fd_third, read_buf, MAX_DATA_UNIT_SIZE) != 5 || strcmp(read_buf, "test") != 0)
+        failures++;
+    ioctl(fd_third, CHANGE_SPSC_CTL, 0);
+    if (failures == 0 && ioctl(fd_third, GET_SPSC_CTL) == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    close(fd_third);
+    }
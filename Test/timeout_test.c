@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+#include <time.h>
+
+#include "const.h"
+
+//milliseconds elapsed since start
+long elapsed(struct timespec *start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+
+int main(int argc, char** argv){
+    int ret;
+    int i;
+    long waited;
+    char read_buf[MAX_DATA_UNIT_SIZE];
+    struct timespec start;
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    // TEST 1
+    printf("TEST 1: blocking read on an empty mailslot times out - ");
+    ioctl(fd, CHANGE_READ_TIMEOUT_CTL, 500);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    waited = elapsed(&start);
+    if (ret < 0 && errno == ETIMEDOUT && waited >= 500 && waited < 1500)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: blocking read with a timeout gets an available message - ");
+    write(fd, "test", 5);
+    ret = read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    if (ret == 5)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: blocking write on a full mailslot times out - ");
+    for (i=0 ; i<MAX_STORAGE/MAX_DATA_UNIT_SIZE ; i++)
+        write(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    ioctl(fd, CHANGE_WRITE_TIMEOUT_CTL, 500);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = write(fd, "test", 5);
+    waited = elapsed(&start);
+    if (ret < 0 && errno == ETIMEDOUT && waited >= 500 && waited < 1500)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd, CHANGE_READ_TIMEOUT_CTL, 0);
+    ioctl(fd, CHANGE_WRITE_TIMEOUT_CTL, 0);
+
+    while(ioctl(fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    close(fd);
+    }
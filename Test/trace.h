@@ -0,0 +1,43 @@
+#ifndef MAIL_SLOT_TRACE_HEADER
+#define MAIL_SLOT_TRACE_HEADER
+
+/*
+ * Trace of the mail slot traffic of an application, written by trace_recorder.so and replayed by
+ * trace_replayer. The file is a trace_header followed by one trace_record per open, close, ioctl,
+ * read or write on a /dev/mailslot<minor> file, in the byte order of the host. Times are
+ * CLOCK_MONOTONIC nanoseconds. Every open of a mail slot is a session, numbered from 0 in the order
+ * of the opens, and the records of its calls carry that number and the thread that made them.
+ */
+
+#define TRACE_MAGIC 0x43525446          /* "FTRC" in memory on little endian hosts */
+#define TRACE_VERSION 2
+
+#define TRACE_WRITE 0
+#define TRACE_READ 1
+#define TRACE_OPEN 2
+#define TRACE_CLOSE 3
+#define TRACE_IOCTL 4
+
+#define TRACE_DEVICE_PREFIX "/dev/mailslot"
+#define TRACE_MAX_MINOR 255
+
+struct trace_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long start_ns;        /* the timestamps of the records are relative to it */
+};
+
+struct trace_record {
+    unsigned long long ts_ns;           /* when the call was made */
+    unsigned long long arg;             /* TRACE_IOCTL: the argument of the command */
+    unsigned int duration_ns;           /* how long it took, saturated at 4 seconds */
+    int result;                         /* bytes moved or value returned, or -errno */
+    unsigned int size;                  /* bytes requested, the flags of TRACE_OPEN or the command of TRACE_IOCTL */
+    unsigned int tid;                   /* thread of the application that made the call */
+    unsigned int session;
+    unsigned short minor;
+    unsigned char op;                   /* TRACE_WRITE, TRACE_READ, TRACE_OPEN, TRACE_CLOSE or TRACE_IOCTL */
+    unsigned char nonblocking;          /* O_NONBLOCK was set on the file when the call was made */
+};
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * LD_PRELOAD shim recording the mail slot traffic of an application:
+ *
+ *     MAILSLOT_TRACE=app.trace LD_PRELOAD=./trace_recorder.so ./app
+ *
+ * Every open, close, ioctl, read and write on a file opened as /dev/mailslot<minor> is timed and
+ * appended to the trace (mailslot.trace if MAILSLOT_TRACE is not set), with the thread that made
+ * it. A child process writes to a trace of its own, named after the one of the parent followed by
+ * its pid. Payloads and the buffers pointed to by ioctl arguments are not recorded.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define MAX_TRACED_FDS 1024
+#define MAX_DURATION_NS 4000000000ULL
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_ioctl)(int, unsigned long, ...);
+
+static int minors[MAX_TRACED_FDS];      /* minor of the mail slot open on the fd plus one, 0 if none */
+static unsigned int sessions[MAX_TRACED_FDS];
+static unsigned int next_session;
+static char trace_path[4096];
+static FILE *trace;
+static unsigned long long start_ns;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void trace_open(const char *path){
+    struct trace_header header;
+
+    trace = fopen(path, "w");
+    if (!trace){
+        fprintf(stderr, "trace_recorder: cannot create %s: %s\n", path, strerror(errno));
+        return;
+    }
+    start_ns = now_ns();
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.start_ns = start_ns;
+    fwrite(&header, sizeof(header), 1, trace);
+}
+
+//the buffer is flushed before a fork so that the child does not write the records of the parent again
+static void trace_prepare_fork(void){
+    pthread_mutex_lock(&trace_lock);
+    if (trace)
+        fflush(trace);
+}
+
+static void trace_parent_fork(void){
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_child_fork(void){
+    char path[4200];
+
+    if (trace){
+        fclose(trace);
+        snprintf(path, sizeof(path), "%s.%d", trace_path, getpid());
+        trace_open(path);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+//the constructor of another library may do I/O before the one of the shim runs
+static void trace_resolve(void){
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_open64 = dlsym(RTLD_NEXT, "open64");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_write = dlsym(RTLD_NEXT, "write");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+}
+
+static void __attribute__((constructor)) trace_init(void){
+    const char *path = getenv("MAILSLOT_TRACE");
+
+    trace_resolve();
+    snprintf(trace_path, sizeof(trace_path), "%s", path ? path : "mailslot.trace");
+    trace_open(trace_path);
+    pthread_atfork(trace_prepare_fork, trace_parent_fork, trace_child_fork);
+}
+
+static void __attribute__((destructor)) trace_fini(void){
+    pthread_mutex_lock(&trace_lock);
+    if (trace)
+        fclose(trace);
+    trace = NULL;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+//errno is saved for the caller, writing the record may change it
+static void trace_append(int fd, int op, unsigned int size, unsigned long long arg, ssize_t result, int nonblocking, unsigned long long begin){
+    int err = errno;
+    unsigned long long duration = now_ns() - begin;
+    struct trace_record record;
+
+    memset(&record, 0, sizeof(record));
+    record.ts_ns = begin - start_ns;
+    record.arg = arg;
+    record.duration_ns = duration > MAX_DURATION_NS ? MAX_DURATION_NS : duration;
+    record.result = result < 0 ? -err : result;
+    record.size = size;
+    record.tid = syscall(SYS_gettid);
+    record.minor = minors[fd] - 1;
+    record.op = op;
+    record.nonblocking = nonblocking;
+
+    pthread_mutex_lock(&trace_lock);
+    record.session = sessions[fd];
+    if (trace)
+        fwrite(&record, sizeof(record), 1, trace);
+    pthread_mutex_unlock(&trace_lock);
+    errno = err;
+}
+
+//a successful open of a mail slot starts a session, the open is recorded as its first call
+static void trace_track(int fd, const char *path, int flags, unsigned long long begin){
+    char *end;
+    long minor;
+
+    if (fd < 0 || fd >= MAX_TRACED_FDS)
+        return;
+    minors[fd] = 0;
+    if (strncmp(path, TRACE_DEVICE_PREFIX, strlen(TRACE_DEVICE_PREFIX)) != 0)
+        return;
+    minor = strtol(path + strlen(TRACE_DEVICE_PREFIX), &end, 10);
+    if (end == path + strlen(TRACE_DEVICE_PREFIX) || *end || minor < 0 || minor > TRACE_MAX_MINOR)
+        return;
+    minors[fd] = minor + 1;
+    pthread_mutex_lock(&trace_lock);
+    sessions[fd] = next_session++;
+    pthread_mutex_unlock(&trace_lock);
+    if (trace)
+        trace_append(fd, TRACE_OPEN, flags, 0, 0, (flags & O_NONBLOCK) != 0, begin);
+}
+
+static int traced(int fd){
+    return fd >= 0 && fd < MAX_TRACED_FDS && minors[fd] && trace;
+}
+
+//the application may switch O_NONBLOCK with fcntl at any time, so it is read at every call
+static int trace_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL);
+
+    return flags != -1 && (flags & O_NONBLOCK);
+}
+
+int open(const char *path, int flags, ...){
+    int fd;
+    mode_t mode = 0;
+    unsigned long long begin;
+    va_list args;
+
+    if (!real_open)
+        trace_resolve();
+    if (flags & (O_CREAT | O_TMPFILE)){
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    begin = now_ns();
+    fd = real_open(path, flags, mode);
+    trace_track(fd, path, flags, begin);
+    return fd;
+}
+
+int open64(const char *path, int flags, ...){
+    int fd;
+    mode_t mode = 0;
+    unsigned long long begin;
+    va_list args;
+
+    if (!real_open64)
+        trace_resolve();
+    if (flags & (O_CREAT | O_TMPFILE)){
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    begin = now_ns();
+    fd = real_open64(path, flags, mode);
+    trace_track(fd, path, flags, begin);
+    return fd;
+}
+
+int close(int fd){
+    int ret;
+    unsigned long long begin;
+
+    if (!real_close)
+        trace_resolve();
+    if (!traced(fd)){
+        if (fd >= 0 && fd < MAX_TRACED_FDS)
+            minors[fd] = 0;
+        return real_close(fd);
+    }
+    begin = now_ns();
+    ret = real_close(fd);
+    trace_append(fd, TRACE_CLOSE, 0, 0, ret, 0, begin);
+    minors[fd] = 0;
+    return ret;
+}
+
+//the argument is recorded as a value, what it points to is not
+int ioctl(int fd, unsigned long request, ...){
+    int ret;
+    int nonblocking;
+    unsigned long arg;
+    unsigned long long begin;
+    va_list args;
+
+    if (!real_ioctl)
+        trace_resolve();
+    va_start(args, request);
+    arg = va_arg(args, unsigned long);
+    va_end(args);
+    if (!traced(fd))
+        return real_ioctl(fd, request, arg);
+    nonblocking = trace_nonblocking(fd);
+    begin = now_ns();
+    ret = real_ioctl(fd, request, arg);
+    trace_append(fd, TRACE_IOCTL, request, arg, ret, nonblocking, begin);
+    return ret;
+}
+
+ssize_t read(int fd, void *buf, size_t count){
+    int nonblocking;
+    ssize_t ret;
+    unsigned long long begin;
+
+    if (!real_read)
+        trace_resolve();
+    if (!traced(fd))
+        return real_read(fd, buf, count);
+    nonblocking = trace_nonblocking(fd);
+    begin = now_ns();
+    ret = real_read(fd, buf, count);
+    trace_append(fd, TRACE_READ, count, 0, ret, nonblocking, begin);
+    return ret;
+}
+
+ssize_t write(int fd, const void *buf, size_t count){
+    int nonblocking;
+    ssize_t ret;
+    unsigned long long begin;
+
+    if (!real_write)
+        trace_resolve();
+    if (!traced(fd))
+        return real_write(fd, buf, count);
+    nonblocking = trace_nonblocking(fd);
+    begin = now_ns();
+    ret = real_write(fd, buf, count);
+    trace_append(fd, TRACE_WRITE, count, 0, ret, nonblocking, begin);
+    return ret;
+}
@@ -0,0 +1,461 @@
+/*
+ * Replays a trace written by trace_recorder.so against the device and compares the replay with the
+ * recording:
+ *
+ *     ./trace_replayer MAJOR trace_file [speed]
+ *
+ * The operations are issued at their timestamps, speed times faster than recorded (1 by default, 0
+ * to issue the ones of each thread back to back). Every recorded thread gets a replay thread of its
+ * own and every recorded session a session of its own, opened with the recorded flags, so blocking
+ * calls wait as they did and a slot sees the shape of sessions it saw in production. The O_NONBLOCK
+ * flag of a session is set to the recorded one before each read and write, and the ioctls taking a
+ * value are replayed, which covers the changes of blocking mode. The ioctls taking a pointer are
+ * skipped, the buffer they pointed to is not recorded. A session used but not opened in the trace,
+ * as one inherited across a fork, is opened read write before the replay starts. Payloads are not
+ * recorded, messages are written filled with a pattern.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "const.h"
+#include "trace.h"
+
+struct replay_op {
+    struct trace_record record;
+    unsigned long long duration_ns;     /* of the replayed call */
+    unsigned long long lag_ns;          /* how late it was issued with respect to the scaled timestamp */
+    int result;
+    int skipped;                        /* an ioctl taking a pointer, not replayed */
+};
+
+struct replay_session {
+    int fd;
+    int state;
+    int opened;                         /* the trace has the open of the session */
+    int minor;
+};
+
+#define SESSION_NOT_OPEN 0
+#define SESSION_OPEN 1
+#define SESSION_CLOSED 2
+
+struct replay_thread {
+    pthread_t thread;
+    unsigned int tid;
+    int *ops;                           /* indexes of the operations of the thread, in timestamp order */
+    int no_ops;
+};
+
+static struct replay_op *ops;
+static int no_ops;
+static struct replay_session *sessions;
+static double speed = 1;
+static size_t buf_size = MAX_DATA_UNIT_SIZE;
+static unsigned long long start;
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sessions_changed = PTHREAD_COND_INITIALIZER;
+
+struct latency_summary {
+    int count;
+    double mean;
+    unsigned long long p50, p99, max;
+};
+
+static unsigned long long now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long ns){
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static int compare_ts(const void *a, const void *b){
+    const struct replay_op *x = a, *y = b;
+
+    return (x->record.ts_ns > y->record.ts_ns) - (x->record.ts_ns < y->record.ts_ns);
+}
+
+//the ioctls whose argument points to a buffer of the application
+static int pointer_ioctl(unsigned int cmd){
+    switch (cmd){
+        case GET_SESSION_STATS_CTL:
+        case GROUP_RECEIVE_CTL:
+        case REGISTER_EVENTFD_CTL:
+        case UNREGISTER_EVENTFD_CTL:
+        case GET_NODE_STATS_CTL:
+        case DRAIN_CTL:
+        case SNAPSHOT_CTL:
+        case RESTORE_CTL:
+            return 1;
+        default:
+            return 0;
+        }
+}
+
+static int compare_ns(const void *a, const void *b){
+    const unsigned long long *x = a, *y = b;
+
+    return (*x > *y) - (*x < *y);
+}
+
+//summary of the recorded (recorded=1) or replayed latencies of the operations of type op
+static struct latency_summary summarize(struct replay_op *ops, int no_ops, int op, int recorded){
+    int i;
+    int n = 0;
+    double sum = 0;
+    unsigned long long *samples = malloc(sizeof(unsigned long long) * (no_ops ? no_ops : 1));
+    struct latency_summary summary;
+
+    memset(&summary, 0, sizeof(summary));
+    for (i=0 ; i<no_ops ; i++){
+        if (ops[i].record.op != op)
+            continue;
+        samples[n] = recorded ? ops[i].record.duration_ns : ops[i].duration_ns;
+        sum += samples[n++];
+        }
+    if (n){
+        qsort(samples, n, sizeof(unsigned long long), compare_ns);
+        summary.count = n;
+        summary.mean = sum / n;
+        summary.p50 = samples[n / 2];
+        summary.p99 = samples[(n * 99) / 100];
+        summary.max = samples[n - 1];
+        }
+    free(samples);
+    return summary;
+}
+
+static double deviation(double recorded, double replayed){
+    return recorded ? 100.0 * (replayed - recorded) / recorded : 0;
+}
+
+static void report_latency(const char *name, struct replay_op *ops, int no_ops, int op){
+    struct latency_summary rec = summarize(ops, no_ops, op, 1);
+    struct latency_summary rep = summarize(ops, no_ops, op, 0);
+
+    if (!rec.count)
+        return;
+    printf("%s latency (ns)   recorded: mean %.0f p50 %llu p99 %llu max %llu\n", name, rec.mean, rec.p50, rec.p99, rec.max);
+    printf("%s latency (ns)   replayed: mean %.0f p50 %llu p99 %llu max %llu\n", name, rep.mean, rep.p50, rep.p99, rep.max);
+    printf("%s latency deviation: mean %+.1f%% p50 %+.1f%% p99 %+.1f%%\n", name,
+           deviation(rec.mean, rep.mean), deviation(rec.p50, rep.p50), deviation(rec.p99, rep.p99));
+}
+
+
+//waits for the session to be opened by the thread that opened it in the recording
+static int session_fd(unsigned int session){
+    int fd;
+
+    pthread_mutex_lock(&sessions_lock);
+    while (sessions[session].state == SESSION_NOT_OPEN)
+        pthread_cond_wait(&sessions_changed, &sessions_lock);
+    fd = sessions[session].fd;
+    pthread_mutex_unlock(&sessions_lock);
+    return fd;
+}
+
+static void session_set(unsigned int session, int fd, int state){
+    pthread_mutex_lock(&sessions_lock);
+    sessions[session].fd = fd;
+    sessions[session].state = state;
+    pthread_cond_broadcast(&sessions_changed);
+    pthread_mutex_unlock(&sessions_lock);
+}
+
+static void *replay_thread(void *arg){
+    int i;
+    int fd;
+    int flags;
+    int ret;
+    char pathname[80];
+    char *buf;
+    unsigned long long target;
+    unsigned long long begin;
+    struct replay_thread *thread = arg;
+
+    buf = malloc(buf_size);
+    if (!buf){
+        printf("ERROR cannot allocate a buffer of %zu bytes for the thread %u\n", buf_size, thread->tid);
+        exit(-1);
+        }
+    memset(buf, 'x', buf_size);
+
+    for (i=0 ; i<thread->no_ops ; i++){
+        struct replay_op *op = &ops[thread->ops[i]];
+        struct trace_record *record = &op->record;
+
+        if (record->op == TRACE_IOCTL && pointer_ioctl(record->size)){
+            op->skipped = 1;
+            continue;
+            }
+
+        target = start;
+        if (speed > 0)
+            target += (unsigned long long)((record->ts_ns - ops[0].record.ts_ns) / speed);
+        if (now_ns() < target)
+            sleep_until(target);
+
+        if (record->op == TRACE_OPEN){
+            sprintf(pathname, TRACE_DEVICE_PREFIX "%d", record->minor);
+            begin = now_ns();
+            fd = open(pathname, record->size, 0666);
+            ret = fd < 0 ? -1 : 0;
+            op->duration_ns = now_ns() - begin;
+            op->result = ret < 0 ? -errno : ret;
+            session_set(record->session, fd, SESSION_OPEN);
+            }
+        else{
+            fd = session_fd(record->session);
+            if ((record->op == TRACE_READ || record->op == TRACE_WRITE) && fd != -1){
+                flags = fcntl(fd, F_GETFL);
+                if (flags != -1 && !(flags & O_NONBLOCK) != !record->nonblocking)
+                    fcntl(fd, F_SETFL, record->nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+                }
+
+            begin = now_ns();
+            if (fd == -1){
+                ret = -1;
+                errno = EBADF;
+                }
+            else if (record->op == TRACE_WRITE)
+                ret = write(fd, buf, record->size);
+            else if (record->op == TRACE_READ)
+                //no message is longer than the largest write, a larger read gets the same result
+                ret = read(fd, buf, record->size < buf_size ? record->size : buf_size);
+            else if (record->op == TRACE_IOCTL)
+                ret = ioctl(fd, record->size, (unsigned long)record->arg);
+            else
+                ret = close(fd);
+            op->duration_ns = now_ns() - begin;
+            op->result = ret < 0 ? -errno : ret;
+            if (record->op == TRACE_CLOSE && fd != -1)
+                session_set(record->session, -1, SESSION_CLOSED);
+            }
+        op->lag_ns = begin > target ? begin - target : 0;
+        }
+    free(buf);
+    return NULL;
+}
+
+
+int main(int argc, char** argv){
+    int i, j;
+    int minor;
+    int fd;
+    int mismatches = 0;
+    int skipped = 0;
+    int replayed = 0;
+    int capacity = 1024;
+    int drained;
+    int no_minors = 0;
+    int no_threads = 0;
+    unsigned int no_sessions = 0;
+    unsigned long long span;
+    unsigned long long replay_span;
+    unsigned long long lag_sum = 0;
+    unsigned long long lag_max = 0;
+    unsigned long long bytes = 0;
+    char pathname[80];
+    char *buf;
+    int used_minors[TRACE_MAX_MINOR + 1];
+    struct trace_header header;
+    struct replay_thread *threads;
+    FILE *trace;
+
+	if(argc < 3 || argc > 4){
+		printf("usage: %s MAJOR trace_file [speed]\n", argv[0]);
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+    if (argc == 4)
+        speed = atof(argv[3]);
+    if (speed < 0){
+        printf("the speed should be a positive factor, or 0 to replay as fast as possible\n");
+        return -1;
+        }
+
+    trace = fopen(argv[2], "r");
+    if (!trace){
+        printf("ERROR while opening the trace %s: %s\n", argv[2], strerror(errno));
+        return -1;
+        }
+    if (fread(&header, sizeof(header), 1, trace) != 1 || header.magic != TRACE_MAGIC){
+        printf("ERROR %s is not a mail slot trace\n", argv[2]);
+        return -1;
+        }
+    if (header.version != TRACE_VERSION){
+        printf("ERROR %s has version %u of the format, this replayer reads version %d\n", argv[2], header.version, TRACE_VERSION);
+        return -1;
+        }
+
+    ops = malloc(sizeof(struct replay_op) * capacity);
+    while (ops && fread(&ops[no_ops].record, sizeof(struct trace_record), 1, trace) == 1){
+        struct trace_record *record = &ops[no_ops].record;
+
+        if (record->minor > TRACE_MAX_MINOR || record->op > TRACE_IOCTL || record->session >= (1U << 24)){
+            printf("ERROR record %d of the trace is corrupted\n", no_ops);
+            return -1;
+            }
+        //the writes are replayed with their recorded size, even the ones beyond MAX_DATA_UNIT_SIZE
+        if (record->op == TRACE_WRITE && record->size > buf_size)
+            buf_size = record->size;
+        if (record->session >= no_sessions)
+            no_sessions = record->session + 1;
+        if (++no_ops == capacity){
+            capacity *= 2;
+            ops = realloc(ops, sizeof(struct replay_op) * capacity);
+            }
+        }
+    fclose(trace);
+    if (!ops){
+        printf("ERROR the trace does not fit in memory\n");
+        return -1;
+        }
+    if (no_ops == 0){
+        printf("the trace is empty\n");
+        return 0;
+        }
+    for (i=0 ; i<no_ops ; i++){
+        ops[i].duration_ns = ops[i].lag_ns = 0;
+        ops[i].result = ops[i].skipped = 0;
+        }
+
+    //the threads of the application append their records concurrently
+    qsort(ops, no_ops, sizeof(struct replay_op), compare_ts);
+
+    sessions = calloc(no_sessions, sizeof(struct replay_session));
+    threads = calloc(no_ops, sizeof(struct replay_thread));
+    buf = malloc(MAX_DATA_UNIT_SIZE);
+    if (!sessions || !threads || !buf){
+        printf("ERROR the sessions and the threads of the trace do not fit in memory\n");
+        return -1;
+        }
+    for (i=0 ; i<(int)no_sessions ; i++)
+        sessions[i].fd = -1;
+    for (minor=0 ; minor<=TRACE_MAX_MINOR ; minor++)
+        used_minors[minor] = 0;
+
+    //a thread per recorded thread, with its operations in timestamp order
+    for (i=0 ; i<no_ops ; i++){
+        struct trace_record *record = &ops[i].record;
+
+        for (j=0 ; j<no_threads && threads[j].tid != record->tid ; j++);
+        if (j == no_threads){
+            threads[j].tid = record->tid;
+            threads[j].ops = malloc(sizeof(int) * no_ops);
+            if (!threads[j].ops){
+                printf("ERROR the threads of the trace do not fit in memory\n");
+                return -1;
+                }
+            no_threads++;
+            }
+        threads[j].ops[threads[j].no_ops++] = i;
+        if (record->op == TRACE_OPEN)
+            sessions[record->session].opened = 1;
+        sessions[record->session].minor = record->minor;
+        used_minors[record->minor] = 1;
+        }
+
+    for (minor=0 ; minor<=TRACE_MAX_MINOR ; minor++){
+        if (!used_minors[minor])
+            continue;
+
+        sprintf(pathname, TRACE_DEVICE_PREFIX "%d", minor);
+        if (mknod(pathname, S_IFCHR|0666, makedev(major, minor)) == -1 && errno != EEXIST){
+            printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+            return -1;
+            }
+        no_minors++;
+
+        //the replay starts from an empty slot, as the recording is assumed to
+        fd = open(pathname, O_RDONLY | O_NONBLOCK);
+        if (fd == -1){
+            printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+            return -1;
+            }
+        drained = 0;
+        while (read(fd, buf, MAX_DATA_UNIT_SIZE) > 0)
+            drained++;
+        close(fd);
+        if (drained)
+            printf("%d messages left in the mail slot with minor number %d were discarded\n", drained, minor);
+        }
+    free(buf);
+
+    for (i=0 ; i<(int)no_sessions ; i++){
+        if (sessions[i].opened)
+            continue;
+        sprintf(pathname, TRACE_DEVICE_PREFIX "%d", sessions[i].minor);
+        sessions[i].fd = open(pathname, O_RDWR);
+        if (sessions[i].fd == -1){
+            printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+            return -1;
+            }
+        sessions[i].state = SESSION_OPEN;
+        }
+
+    //every thread starts from the same instant, once all of them exist
+    start = now_ns() + 10000000ULL;
+    for (j=0 ; j<no_threads ; j++){
+        if (pthread_create(&threads[j].thread, NULL, replay_thread, &threads[j])){
+            printf("ERROR cannot create the replay thread for the thread %u\n", threads[j].tid);
+            return -1;
+            }
+        }
+    for (j=0 ; j<no_threads ; j++)
+        pthread_join(threads[j].thread, NULL);
+    replay_span = now_ns() - start;
+    span = ops[no_ops - 1].record.ts_ns + ops[no_ops - 1].record.duration_ns - ops[0].record.ts_ns;
+
+    for (i=0 ; i<no_ops ; i++){
+        if (ops[i].skipped){
+            skipped++;
+            continue;
+            }
+        replayed++;
+        lag_sum += ops[i].lag_ns;
+        if (ops[i].lag_ns > lag_max)
+            lag_max = ops[i].lag_ns;
+        if ((ops[i].record.op == TRACE_READ || ops[i].record.op == TRACE_WRITE) && ops[i].result > 0)
+            bytes += ops[i].result;
+        if (ops[i].result != ops[i].record.result)
+            mismatches++;
+        }
+
+    printf("operations: %d on %d mail slots by %d threads on %u sessions, bytes moved: %llu, speed: %g\n", no_ops, no_minors,
+           no_threads, no_sessions, bytes, speed);
+    printf("ioctls skipped (they take a pointer): %d\n", skipped);
+    printf("throughput recorded: %.0f ops/s over %.3f ms\n", span ? replayed * 1e9 / span : 0, span / 1e6);
+    printf("throughput replayed: %.0f ops/s over %.3f ms\n", replay_span ? replayed * 1e9 / replay_span : 0, replay_span / 1e6);
+    report_latency("write", ops, no_ops, TRACE_WRITE);
+    report_latency("read", ops, no_ops, TRACE_READ);
+    printf("start lag (ns): mean %.0f max %llu\n", replayed ? (double)lag_sum / replayed : 0, lag_max);
+    printf("results different from the recording: %d\n", mismatches);
+
+    for (i=0 ; i<(int)no_sessions ; i++)
+        if (sessions[i].fd != -1)
+            close(sessions[i].fd);
+    for (j=0 ; j<no_threads ; j++)
+        free(threads[j].ops);
+    free(threads);
+    free(sessions);
+    free(ops);
+    return 0;
+    }
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio_ext.h>
+
+#include "const.h"
+
+
+int main(int argc, char** argv){
+    int ret;
+    long expired;
+    char read_buf[MAX_DATA_UNIT_SIZE];
+
+	if(argc!=3){
+		printf("you should pass MAJOR number and MINOR number as parameters\n");
+		return -1;
+	}
+
+	int major = atoi(argv[1]);
+	int minor = atoi(argv[2]);
+	dev_t device = makedev(major, minor);
+
+    char pathname[80];
+    sprintf(pathname,"/dev/mailslot%d", minor);
+
+	if( mknod(pathname, S_IFCHR|0666, device) == -1){
+		if(errno == EEXIST)
+			printf("Pathname '%s' already exists\n",pathname);
+		else{
+			printf("ERROR in the creation of the file %s: %s\n", pathname, strerror(errno));
+			return -1;
+            }
+        }
+
+	int fd = open(pathname, 0666);
+
+	if(fd == -1){
+		printf("ERROR while opening the file %s: %s\n", pathname, strerror(errno));
+		return -1;
+        }
+
+    while(ioctl(fd,GET_FREESPACE_SIZE_CTL) < MAX_STORAGE){
+        read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    }
+
+    ioctl(fd, CHANGE_READ_BLOCKING_MODE_CTL, 0);
+    expired = ioctl(fd, GET_EXPIRED_CTL);
+
+    // TEST 1
+    printf("TEST 1: an expired message is not delivered - ");
+    ioctl(fd, CHANGE_SLOT_TTL_CTL, 200);
+    write(fd, "test", 5);
+    usleep(400000);
+    ret = read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    if (ret < 0 && errno == EAGAIN && ioctl(fd, GET_EXPIRED_CTL) == expired+1)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 2
+    printf("TEST 2: expired messages are reclaimed without readers - ");
+    write(fd, "test", 5);
+    usleep(400000);
+    if (ioctl(fd, GET_FREESPACE_SIZE_CTL) == MAX_STORAGE && ioctl(fd, GET_EXPIRED_CTL) == expired+2)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 3
+    printf("TEST 3: the ttl of the session overrides the one of the slot - ");
+    ioctl(fd, CHANGE_MESSAGE_TTL_CTL, 5000);
+    write(fd, "test", 5);
+    usleep(400000);
+    ret = read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    if (ret == 5)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    // TEST 4
+    printf("TEST 4: an expired message does not hide the next one - ");
+    ioctl(fd, CHANGE_MESSAGE_TTL_CTL, 0);
+    write(fd, "old", 4);
+    usleep(400000);
+    ioctl(fd, CHANGE_SLOT_TTL_CTL, 0);
+    write(fd, "new", 4);
+    ret = read(fd, read_buf, MAX_DATA_UNIT_SIZE);
+    if (ret == 4 && strcmp(read_buf, "new") == 0)
+        printf("PASSED\n");
+    else
+        printf("NOT PASSED\n");
+
+    ioctl(fd, CHANGE_READ_BLOCKING_MODE_CTL, 1);
+
+    close(fd);
+    }
@@ -7,6 +7,16 @@
 #include <linux/semaphore.h>
 #include <linux/spinlock.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/percpu_counter.h>
+#include <linux/sched/clock.h>
+#include <linux/sched/signal.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/eventfd.h>
+#include <linux/llist.h>
+#include <linux/pagemap.h>
 #include <linux/pid.h>		/* For pid types */
 #include <linux/version.h>	/* For LINUX_VERSION_CODE */
 
@@ -22,6 +32,24 @@ static spinlock_t open_release_lock;
 
 static struct fifomailslot_dev* mailslot_devices[MAX_MINOR_NUMBER];
 
+static int slot_node = NUMA_NO_NODE;
+module_param(slot_node, int, 0444);
+MODULE_PARM_DESC(slot_node, "node the slots are allocated on, by default the node of the process that opens them first");
+
+/*
+ * Spins until condition holds or budget_ns nanoseconds have elapsed, giving up early if the cpu
+ * is needed by somebody else or a signal arrives. Evaluates to the last value of condition.
+ */
+#define fifomailslot_busy_poll(budget_ns, condition)                                    \
+({                                                                                      \
+    u64 __end = local_clock() + (budget_ns);                                            \
+    int __ready;                                                                        \
+    while (!(__ready = (condition)) && local_clock() < __end &&                        \
+           !need_resched() && !signal_pending(current))                                 \
+        cpu_relax();                                                                    \
+    __ready;                                                                            \
+})
+
 
 /* the actual driver */
 
@@ -29,6 +57,7 @@ static int fifomailslot_open(struct inode *inode, struct file *file){
     int minor;
     struct fifomailslot_dev *dev;
     struct fifomailslot_dev *tmp;
+    struct fifomailslot_session *session;
 
     minor = iminor(inode);
 
@@ -39,9 +68,20 @@ static int fifomailslot_open(struct inode *inode, struct file *file){
 
     printk(KERN_INFO "%s: mail slot with minor number %d opened by the process %d\n", DEVICE_NAME, minor,current->pid);
 
-    //preallocating memory before entering the critical section since kmalloc might go to sleep
-    tmp = kmalloc(sizeof(struct fifomailslot_dev), GFP_KERNEL);
-    memset(tmp, 0, sizeof(struct fifomailslot_dev));
+    session = kzalloc(sizeof(struct fifomailslot_session), GFP_KERNEL);
+    if (!session)
+        return -ENOMEM;
+
+    //preallocating memory before entering the critical section since kmalloc might go to sleep,
+    //the slots are never freed before the module is removed so it is needed only if the slot is missing now
+    tmp = NULL;
+    if (!READ_ONCE(mailslot_devices[minor])){
+        tmp = fifomailslot_alloc_dev();
+        if (!tmp){
+            kfree(session);
+            return -ENOMEM;
+        }
+    }
 
     spin_lock(&open_release_lock);
 
@@ -54,14 +94,37 @@ static int fifomailslot_open(struct inode *inode, struct file *file){
         dev = mailslot_devices[minor];
         }
     else{
-        kfree(tmp);
         printk(KERN_INFO "%s: device already present\n", DEVICE_NAME);
         }
 
 	atomic_inc(&dev->no_sessions);
+	if (file->f_mode & FMODE_READ)
+		atomic_inc(&dev->reader_sessions);
+	if (file->f_mode & FMODE_WRITE)
+		atomic_inc(&dev->writer_sessions);
 
 	spin_unlock(&open_release_lock);
 
+    if (tmp && tmp != dev)
+        fifomailslot_free_dev(tmp);
+
+    session->dev = dev;
+    session->blocking_write = 1;
+    session->blocking_read = 1;
+    session->max_data_unit_size = MAX_DATA_UNIT_SIZE;
+    session->shard_cpu = -1;
+    INIT_LIST_HEAD(&session->subscriber_list);
+    file->private_data = session;
+
+    //every session that can read is a subscriber, it only sees the messages published after this point
+    if (file->f_mode & FMODE_READ){
+        mutex_lock(&dev->mutex);
+        list_add_tail(&session->subscriber_list, &dev->subscribers);
+        session->subscribed = 1;
+        mutex_unlock(&dev->mutex);
+    }
+
+    fifomailslot_spsc_update(dev);
     return 0;
 }
 
@@ -69,14 +132,39 @@ static int fifomailslot_open(struct inode *inode, struct file *file){
 static int fifomailslot_release(struct inode *inode, struct file *file){
     int minor;
     struct fifomailslot_dev *dev;
+    struct fifomailslot_session *session = file->private_data;
 
     minor = iminor(inode);
 
+    if (session->busy_poll_usecs)
+        atomic_dec(&session->dev->busy_poll_sessions);
+    if (session->message_ttl)
+        atomic_dec(&session->dev->ttl_sessions);
+
+    if (session->subscribed || (file->f_mode & FMODE_WRITE)){
+        mutex_lock(&session->dev->mutex);
+        if (session->subscribed)
+            fifomailslot_unsubscribe(session);
+        fifomailslot_disown(session);
+        mutex_unlock(&session->dev->mutex);
+        wake_up_interruptible(&session->dev->wq);
+        fifomailslot_notify_space(session->dev);
+    }
+    if (READ_ONCE(session->dev->notify_owner) == session)
+        fifomailslot_unregister_eventfd(session->dev, session);
+    kfree(session);
+
     spin_lock(&open_release_lock);
     dev = mailslot_devices[minor];
     atomic_dec(&dev->no_sessions);
+    if (file->f_mode & FMODE_READ)
+        atomic_dec(&dev->reader_sessions);
+    if (file->f_mode & FMODE_WRITE)
+        atomic_dec(&dev->writer_sessions);
     spin_unlock(&open_release_lock);
 
+    fifomailslot_spsc_update(dev);
+
     printk(KERN_INFO "%s: mail slot with minor number %d closed by the process %d\n", DEVICE_NAME, minor,current->pid);
 
     return 0;
@@ -91,17 +179,26 @@ static ssize_t fifomailslot_write(struct file *filp, const char *buff, size_t le
     char tmp[len];
     struct fifomailslot_dev *dev;
     struct fifomailslot_data * mesg_data;
-    char * payload;
+    struct fifomailslot_session *session = filp->private_data;
 
     minor = iminor(filp->f_inode);
     dev = mailslot_devices[minor];
 
-    blocking_write = dev->blocking_write;
+    blocking_write = session->blocking_write && !(filp->f_flags & O_NONBLOCK);
+
+    if (dev->mode == SHARDED_SLOT_MODE)
+        return fifomailslot_sharded_write(session, buff, len, blocking_write);
+
+    if (fifomailslot_spsc_in_use(dev)){
+        ret = fifomailslot_spsc_write(session, buff, len, blocking_write);
+        if (ret)
+            return ret;
+    }
 
     printk(KERN_INFO "%s: write called on mail slot with minor number %d by the process %d, blocking=%d, current available space=%ld \n", DEVICE_NAME, minor, current->pid, blocking_write, get_freespace(dev));
 
-    if (len > dev->max_data_unit_size || len == 0){
-        printk(KERN_ERR "%s: ERROR write of a message with too high size, the len was %zu but the maximum data unit size is %ld",DEVICE_NAME, len, dev->max_data_unit_size);
+    if (len > session->max_data_unit_size || len == 0){
+        printk(KERN_ERR "%s: ERROR write of a message with too high size, the len was %zu but the maximum data unit size is %ld",DEVICE_NAME, len, session->max_data_unit_size);
         return -EMSGSIZE;
     }
 
@@ -112,60 +209,99 @@ static ssize_t fifomailslot_write(struct file *filp, const char *buff, size_t le
     }
 
     //i am preallocating memory here before acquiring the lock
-    mesg_data = kmalloc(sizeof(struct fifomailslot_data), GFP_KERNEL);
-	memset(mesg_data, 0, sizeof(struct fifomailslot_data));
-    payload = kmalloc(sizeof(char)*len, GFP_KERNEL);
-    memset(payload, 0, sizeof(char)*len);
+    mesg_data = fifomailslot_alloc_message(dev, len, GFP_KERNEL);
+    if (!mesg_data)
+        return -ENOMEM;
+    memcpy(mesg_data->payload, tmp, len);
+    mesg_data->len = len;
 
-    if (blocking_write){
+lock:
+    //on a lossy slot the writer never gives up, the mutex is held only for short critical sections
+    if (dev->backpressure_policy == BACKPRESSURE_OVERWRITE)
+        mutex_lock(&dev->mutex);
+    else if (blocking_write){
         if (mutex_lock_interruptible(&dev->mutex)){
             printk(KERN_INFO "%s: process %d woken up by a signal\n", DEVICE_NAME, current->pid);
+            fifomailslot_free_message(mesg_data);
             return -ERESTARTSYS;
             }
         }
     else{
         if (!mutex_trylock(&dev->mutex)) {
             printk(KERN_ERR "%s: Resource not available\n", DEVICE_NAME);
-            kfree(mesg_data);
-            kfree(payload);
+            fifomailslot_free_message(mesg_data);
             return -EAGAIN;
             }
         }
 
-    required_space = sizeof(char)*len;
-    ret = fifomailslot_wait_event_interruptible(dev, required_space, mesg_data, payload);
+    required_space = mesg_data->len;
+    if (dev->backpressure_policy == BACKPRESSURE_OVERWRITE){
+        fifomailslot_overwrite_own(session, required_space);
+        fifomailslot_overwrite_oldest(dev, required_space);
+    }
+    else if (dev->mode == FANOUT_SLOT_MODE && dev->slow_subscriber_policy != SLOW_SUBSCRIBER_BLOCK)
+        fifomailslot_fanout_make_room(dev, required_space);
+
+    ret = fifomailslot_wait_event_interruptible(session, required_space, blocking_write, mesg_data);
     if (ret){
         return ret;
     }
 
+    //the ring has been started while this writer was waiting, if it is stopped again the writer starts over
+    if (dev->spsc_active){
+        mutex_unlock(&dev->mutex);
+        ret = fifomailslot_spsc_push(session, mesg_data, blocking_write);
+        if (ret)
+            return ret;
+        goto lock;
+    }
+    //the ring is being stopped, the message must not pass the ones still in it
+    if (dev->spsc_stopping){
+        mutex_unlock(&dev->mutex);
+        if (wait_event_interruptible(dev->wq, !READ_ONCE(dev->spsc_stopping))){
+            fifomailslot_free_message(mesg_data);
+            return -ERESTARTSYS;
+        }
+        goto lock;
+    }
+
     //now i am in critical section and there is enough space to write
     printk(KERN_INFO "%s: write, the process is in critical section and there is enough space to write \n", DEVICE_NAME);
 
-    mesg_data->payload = payload;
-    memcpy(mesg_data->payload, tmp, len);
+    mesg_data->expires = fifomailslot_expiry(session);
+    mesg_data->owner = session;
+    if (mesg_data->expires)
+        schedule_delayed_work(&dev->expire_work, msecs_to_jiffies(EXPIRE_SCAN_INTERVAL_MSECS));
 
-    mesg_data->len = len;
-    atomic_long_add(sizeof(char)*len, &dev->storage_size);
-    printk(KERN_INFO "%s: new storage is: %ld \n", DEVICE_NAME, dev->storage_size.counter);
+    if (atomic_read(&dev->busy_poll_sessions))
+        fifomailslot_record_arrival(dev);
 
-    if (atomic_read(&dev->no_msg) == 0){
-        dev->tail = mesg_data;
-        dev->head = dev->tail;
-    }
-    else{
-        dev->tail->next = mesg_data;
-        dev->tail = dev->tail->next;
+    if (dev->mode == FANOUT_SLOT_MODE){
+        fifomailslot_fanout_publish(dev, mesg_data);
+        mutex_unlock(&dev->mutex);
+        wake_up_interruptible(&dev->readwq);
+        fifomailslot_notify_arrival(dev);
+        session->stats.msgs_written++;
+        session->stats.bytes_written += len;
+        return len;
     }
 
-    dev->tail->next = NULL;
+    atomic_long_add(mesg_data->len, &dev->storage_size);
+    fifomailslot_charge(dev, mesg_data);
+    printk(KERN_INFO "%s: new storage is: %ld \n", DEVICE_NAME, dev->storage_size.counter);
 
-    atomic_inc(&dev->no_msg);
+    fifomailslot_enqueue_locked(dev, mesg_data);
     printk(KERN_INFO "%s: new number of messagges: %d \n", DEVICE_NAME, dev->no_msg.counter);
 
-    up(&dev->readsem);
-
     mutex_unlock(&dev->mutex);
 
+    //blocking readers wait on readwq for the token posted by the enqueue
+    if (wq_has_sleeper(&dev->readwq))
+        wake_up_interruptible(&dev->readwq);
+    fifomailslot_notify_arrival(dev);
+
+    session->stats.msgs_written++;
+    session->stats.bytes_written += len;
     return len;
 }
 
@@ -174,24 +310,64 @@ static ssize_t fifomailslot_read(struct file * filp, char * buff, size_t  len, l
     int minor;
     int blocking_read;
     int mesg_len;
+    long ret;
+    int token = 0;
     char aux[MAX_DATA_UNIT_SIZE];
     struct fifomailslot_dev *dev;
-    struct fifomailslot_data * temp;
+    struct fifomailslot_session *session = filp->private_data;
 
     minor = iminor(filp->f_inode);
     dev = mailslot_devices[minor];
 
-    blocking_read = dev->blocking_read;
+    blocking_read = session->blocking_read && !(filp->f_flags & O_NONBLOCK);
+
+    //a reader that was waiting when the slot mode changed starts over with the new one
+dispatch:
+    if (READ_ONCE(dev->mode) == SHARDED_SLOT_MODE){
+        ret = fifomailslot_sharded_read(session, buff, len, blocking_read);
+        if (ret == READ_MODE_CHANGED)
+            goto dispatch;
+        return ret;
+    }
+
+spsc:
+    if (fifomailslot_spsc_in_use(dev)){
+        ret = fifomailslot_spsc_read(session, buff, len, blocking_read);
+        if (ret)
+            return ret;
+    }
 
     printk(KERN_INFO "%s: read called on mail slot with minor number %d by the process %d, blocking=%d\n", DEVICE_NAME, minor, current->pid, blocking_read);
 
+    if (READ_ONCE(dev->mode) == FANOUT_SLOT_MODE){
+        ret = fifomailslot_fanout_read(session, buff, len, blocking_read);
+        if (ret == READ_MODE_CHANGED)
+            goto dispatch;
+        return ret;
+    }
+
+retry:
     if (blocking_read){
-        if (down_interruptible(&dev->readsem)){
+        if (session->busy_poll_usecs)
+            fifomailslot_busy_poll(fifomailslot_read_poll_budget(session), atomic_read(&dev->no_msg) > 0 || READ_ONCE(dev->spsc_active));
+        //the readers wait on readwq rather than on the semaphore, since starting the ring posts no token
+        ret = wait_event_interruptible_timeout(dev->readwq, fifomailslot_read_ready(dev, &token), fifomailslot_timeout(session->read_timeout));
+        if (ret == 0){
+            printk(KERN_INFO "%s: read, process %d timed out\n", DEVICE_NAME, current->pid);
+            return -ETIMEDOUT;
+            }
+        if (ret < 0){
             printk(KERN_INFO "%s: process %d woken up by a signal read\n", DEVICE_NAME, current->pid);
             return -ERESTARTSYS;
             }
+        if (!token){
+            if (READ_ONCE(dev->mode) != FIFO_SLOT_MODE)
+                goto dispatch;
+            goto spsc;
+        }
         if (mutex_lock_interruptible(&dev->mutex)){
             printk(KERN_INFO "%s: process %d woken up by a signal write\n", DEVICE_NAME, current->pid);
+            fifomailslot_give_back_token(dev);
             return -ERESTARTSYS;
             }
         }
@@ -202,20 +378,103 @@ static ssize_t fifomailslot_read(struct file * filp, char * buff, size_t  len, l
             }
         if (!mutex_trylock(&dev->mutex)){
             printk(KERN_ERR "%s: read, resource not available\n", DEVICE_NAME);
+            fifomailslot_give_back_token(dev);
             return -EAGAIN;
             }
         }
 
+    ret = fifomailslot_dequeue_locked(dev, aux, len);
+    //the messages left by a stop have been consumed, the slot can go back to the ring
+    if (ret > 0 && atomic_read(&dev->no_msg) == 0 && fifomailslot_spsc_sessions_ok(dev))
+        fifomailslot_spsc_start_locked(dev);
+    mutex_unlock(&dev->mutex);
+
+    if (ret == -EAGAIN){
+        //the message of the token has expired and the ring has been started in the meantime
+        if (READ_ONCE(dev->spsc_active))
+            goto spsc;
+        if (!blocking_read){
+            printk(KERN_ERR "%s: read, no message available right now\n",DEVICE_NAME);
+            return -EAGAIN;
+            }
+        goto retry;
+    }
+    if (ret < 0)
+        return -1;
+    mesg_len = ret;
+
+    //this function might sleep but it is not in critical section
+    if (copy_to_user(buff, aux, mesg_len)){
+        printk(KERN_ERR "%s: ERROR in the copy_to_user()",DEVICE_NAME);
+        return -1;
+    }
+
+    fifomailslot_track_consumer(dev);
+    session->stats.msgs_read++;
+    session->stats.bytes_read += mesg_len;
+    return mesg_len;
+}
+
+
+/*
+ * readsem holds one token per queued message. A blocking reader waits on readwq until it takes a
+ * token, the ring is started or the slot leaves FIFO mode, *token tells whether it took one.
+ */
+static int fifomailslot_read_ready(struct fifomailslot_dev *dev, int *token){
+    *token = !down_trylock(&dev->readsem);
+    return *token || READ_ONCE(dev->spsc_active) || READ_ONCE(dev->mode) != FIFO_SLOT_MODE;
+}
+
+//a reader that took a token and did not consume its message posts it again for the others
+static void fifomailslot_give_back_token(struct fifomailslot_dev *dev){
+    up(&dev->readsem);
+    if (wq_has_sleeper(&dev->readwq))
+        wake_up_interruptible(&dev->readwq);
+}
+
+//links a message whose space is already accounted at the tail of a FIFO slot. Called holding dev->mutex
+static void fifomailslot_enqueue_locked(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data){
+    if (atomic_read(&dev->no_msg) == 0){
+        dev->tail = mesg_data;
+        dev->head = dev->tail;
+    }
+    else{
+        dev->tail->next = mesg_data;
+        dev->tail = dev->tail->next;
+    }
+
+    dev->tail->next = NULL;
+
+    atomic_inc(&dev->no_msg);
+    up(&dev->readsem);
+}
+
+/*
+ * Dequeues the head of a FIFO slot into buf. The caller holds dev->mutex and one token of
+ * dev->readsem. Returns the length of the message, -EAGAIN if the message of the token is gone
+ * (the token is consumed) or -EMSGSIZE if it does not fit in len bytes (the token is given back).
+ */
+static int fifomailslot_dequeue_locked(struct fifomailslot_dev *dev, char *buf, size_t len){
+    int mesg_len;
+    struct fifomailslot_data * temp;
+
+    //the message this reader was waiting for may have expired in the meantime
+    if (fifomailslot_expire(dev, 0)){
+        wake_up_interruptible(&dev->wq);
+        fifomailslot_notify_space(dev);
+    }
+    if (!dev->head)
+        return -EAGAIN;
+
     mesg_len = dev->head->len;
 
     if (len < mesg_len){
         printk(KERN_ERR "%s: read, the buffer is too small\n", DEVICE_NAME);
-        mutex_unlock(&dev->mutex);
-        up(&dev->readsem);
-        return -1;
+        fifomailslot_give_back_token(dev);
+        return -EMSGSIZE;
     }
 
-    memcpy(aux, dev->head->payload, mesg_len);
+    memcpy(buf, dev->head->payload, mesg_len);
     temp = dev->head;
     if (dev->head->next)
         dev->head = dev->head->next;
@@ -223,29 +482,262 @@ static ssize_t fifomailslot_read(struct file * filp, char * buff, size_t  len, l
         dev->head = NULL;
 
     printk(KERN_INFO "%s: read, old storage = %ld, space freed = %d\n", DEVICE_NAME, atomic_long_read(&dev->storage_size), mesg_len);
-    atomic_long_sub(sizeof(char)*mesg_len, &dev->storage_size);
-    kfree(temp->payload);
-    kfree(temp);
+    atomic_long_sub(temp->len, &dev->storage_size);
+    fifomailslot_uncharge(dev, temp);
+    fifomailslot_free_message(temp);
     atomic_dec(&dev->no_msg);
     printk(KERN_INFO "%s: read, new storage = %ld\n", DEVICE_NAME, atomic_long_read(&dev->storage_size));
     printk(KERN_INFO "%s: read, remained number of messages %d\n", DEVICE_NAME, atomic_read(&dev->no_msg));
 
-    mutex_unlock(&dev->mutex);
     wake_up_interruptible(&dev->wq);
+    fifomailslot_notify_space(dev);
+    return mesg_len;
+}
 
-    //this function might sleep but it is not in critical section
-    if (copy_to_user(buff, aux, mesg_len)){
-        printk(KERN_ERR "%s: ERROR in the copy_to_user()",DEVICE_NAME);
-        return -1;
+/*
+ * Dequeues the first message of a FIFO or sharded slot into buf without waiting for messages.
+ * Returns its length, -EAGAIN if there is none, -EMSGSIZE if it does not fit in len bytes or
+ * -EOPNOTSUPP for fan-out slots, where a message belongs to a subscriber session.
+ */
+static int fifomailslot_try_dequeue(struct fifomailslot_dev *dev, char *buf, size_t len){
+    int ret;
+    struct fifomailslot_data *mesg_data;
+
+    if (dev->mode == FANOUT_SLOT_MODE)
+        return -EOPNOTSUPP;
+
+    if (dev->mode == SHARDED_SLOT_MODE){
+        mesg_data = fifomailslot_sharded_dequeue(dev, len);
+        if (!mesg_data)
+            return -EAGAIN;
+        if (IS_ERR(mesg_data))
+            return -EMSGSIZE;
+        ret = mesg_data->len;
+        memcpy(buf, mesg_data->payload, ret);
+        percpu_counter_add_batch(&dev->shard_storage_size, -mesg_data->len, SHARD_STORAGE_BATCH);
+        fifomailslot_free_message(mesg_data);
+        if (wq_has_sleeper(&dev->wq))
+            wake_up_interruptible(&dev->wq);
+        fifomailslot_notify_space(dev);
+        return ret;
     }
 
-    return mesg_len;
+    ret = fifomailslot_spsc_try_dequeue(dev, buf, len);
+    if (ret)
+        return ret;
+    //a stop in progress is moving the messages of the ring to the queue
+    wait_event(dev->wq, !READ_ONCE(dev->spsc_stopping));
+    if (down_trylock(&dev->readsem))
+        return -EAGAIN;
+    mutex_lock(&dev->mutex);
+    ret = fifomailslot_dequeue_locked(dev, buf, len);
+    mutex_unlock(&dev->mutex);
+    return ret;
+}
+
+static int fifomailslot_has_messages(struct fifomailslot_dev *dev){
+    if (dev->mode == SHARDED_SLOT_MODE)
+        return fifomailslot_sharded_pending(dev);
+    return atomic_read(&dev->no_msg) > 0 || fifomailslot_spsc_pending(dev);
+}
+
+/*
+ * One pass over the slots of a group receive, starting from the slot after the last one served and
+ * taking at most one message per slot, so that a busy slot cannot starve the others. Returns the
+ * number of records stored, or a negative error if none was, and adds their payload to *bytes.
+ */
+static int fifomailslot_group_pass(struct fifomailslot_session *session, struct fifomailslot_dev **devs, int no_devs,
+                                   char __user *buff, size_t *offset, size_t len, int max_msgs, size_t *bytes){
+    int i;
+    int idx;
+    int ret;
+    int count = 0;
+    size_t room;
+    struct fifomailslot_record record;
+    char aux[MAX_DATA_UNIT_SIZE];
+
+    for (i = 0; i < no_devs && count < max_msgs; i++){
+        idx = (session->group_next + i) % no_devs;
+        if (*offset + sizeof(record) >= len)
+            break;
+        room = min_t(size_t, len - *offset - sizeof(record), MAX_DATA_UNIT_SIZE);
+
+        //a message cannot be put back once taken, so the buffer is faulted in before
+        if (fault_in_writeable(buff + *offset, sizeof(record) + room)){
+            printk(KERN_ERR "%s: ERROR the group receive buffer is not writable\n", DEVICE_NAME);
+            return count ? count : -EFAULT;
+        }
+
+        ret = fifomailslot_try_dequeue(devs[idx], aux, room);
+        if (ret == -EAGAIN)
+            continue;
+        //the buffer is full, the message stays where it is
+        if (ret == -EMSGSIZE){
+            if (*offset == 0)
+                return -EMSGSIZE;
+            break;
+        }
+        if (ret < 0)
+            return count ? count : ret;
+
+        record.minor = devs[idx]->minor;
+        record.len = ret;
+        if (copy_to_user(buff + *offset, &record, sizeof(record)) ||
+            copy_to_user(buff + *offset + sizeof(record), aux, ret)){
+            //the buffer went away after being faulted in, this message is lost but not the stored ones
+            printk(KERN_ERR "%s: ERROR in the copy_to_user()",DEVICE_NAME);
+            return count ? count : -EFAULT;
+        }
+        *offset += FIFOMAILSLOT_RECORD_SIZE(ret);
+        *bytes += ret;
+        session->group_next = (idx + 1) % no_devs;
+        fifomailslot_track_consumer(devs[idx]);
+        count++;
+    }
+    return count;
+}
+
+static long fifomailslot_group_receive(struct file *filp, struct fifomailslot_group_receive __user *arg){
+    int i;
+    int ret;
+    int count = 0;
+    int pending;
+    int blocking_read;
+    long timeout;
+    size_t offset = 0;
+    size_t bytes = 0;
+    int *minors = NULL;
+    struct fifomailslot_dev **devs = NULL;
+    wait_queue_entry_t *waits = NULL;
+    struct fifomailslot_group_receive req;
+    struct fifomailslot_session *session = filp->private_data;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+    if (req.no_minors < 1 || req.no_minors > MAX_MINOR_NUMBER || req.max_msgs < 1 || req.len <= sizeof(struct fifomailslot_record))
+        return -EINVAL;
+
+    minors = kmalloc_array(req.no_minors, sizeof(int), GFP_KERNEL);
+    devs = kmalloc_array(req.no_minors, sizeof(struct fifomailslot_dev *), GFP_KERNEL);
+    waits = kmalloc_array(req.no_minors, sizeof(wait_queue_entry_t), GFP_KERNEL);
+    if (!minors || !devs || !waits){
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(minors, req.minors, req.no_minors * sizeof(int))){
+        ret = -EFAULT;
+        goto out;
+    }
+
+    //the slots are never freed before the module is removed, so they can be used without the open lock
+    for (i = 0; i < req.no_minors; i++){
+        if (minors[i] < 0 || minors[i] >= MAX_MINOR_NUMBER || !(devs[i] = READ_ONCE(mailslot_devices[minors[i]]))){
+            ret = -ENODEV;
+            goto out;
+        }
+        if (devs[i]->mode == FANOUT_SLOT_MODE){
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    if (session->group_next >= req.no_minors)
+        session->group_next = 0;
+
+    blocking_read = session->blocking_read && !(filp->f_flags & O_NONBLOCK);
+    timeout = fifomailslot_timeout(session->read_timeout);
+
+    while (1){
+        //keep serving the slots round robin until they are empty or the caller has enough
+        do {
+            ret = fifomailslot_group_pass(session, devs, req.no_minors, req.buff, &offset, req.len, req.max_msgs - count, &bytes);
+            //the records stored by the previous passes are returned, the error only if there are none
+            if (ret < 0){
+                if (count > 0)
+                    ret = count;
+                goto out;
+            }
+            count += ret;
+        } while (ret > 0 && count < req.max_msgs);
+
+        if (count > 0){
+            ret = count;
+            goto out;
+        }
+        if (!blocking_read){
+            ret = -EAGAIN;
+            goto out;
+        }
+
+        //sleep on all the slots at once, any write wakes this reader up
+        for (i = 0; i < req.no_minors; i++){
+            init_waitqueue_entry(&waits[i], current);
+            add_wait_queue(&devs[i]->readwq, &waits[i]);
+        }
+        ret = 0;
+        while (1){
+            set_current_state(TASK_INTERRUPTIBLE);
+            for (pending = 0, i = 0; i < req.no_minors && !pending; i++)
+                pending = fifomailslot_has_messages(devs[i]);
+            if (pending)
+                break;
+            if (signal_pending(current)){
+                ret = -ERESTARTSYS;
+                break;
+            }
+            if (!timeout){
+                ret = -ETIMEDOUT;
+                break;
+            }
+            timeout = schedule_timeout(timeout);
+        }
+        __set_current_state(TASK_RUNNING);
+        for (i = 0; i < req.no_minors; i++)
+            remove_wait_queue(&devs[i]->readwq, &waits[i]);
+        if (ret)
+            goto out;
+    }
+
+out:
+    kfree(waits);
+    kfree(devs);
+    kfree(minors);
+    if (count > 0){
+        session->stats.msgs_read += count;
+        //the payload only, as a read counts it, not the record headers and their padding
+        session->stats.bytes_read += bytes;
+    }
+    return ret;
 }
 
 
+static long fifomailslot_get_node_stats(struct fifomailslot_dev *dev, struct fifomailslot_node_stats __user *arg){
+    int cpu;
+    struct fifomailslot_node_stats stats;
+    struct fifomailslot_node_stats *cpu_stats;
+
+    if (copy_from_user(&stats, arg, sizeof(stats)))
+        return -EFAULT;
+    if (stats.node < 0 || stats.node >= nr_node_ids)
+        return -EINVAL;
+
+    stats.msgs = 0;
+    stats.bytes = 0;
+    for_each_possible_cpu(cpu){
+        cpu_stats = per_cpu_ptr(dev->node_stats, cpu) + stats.node;
+        stats.msgs += READ_ONCE(cpu_stats->msgs);
+        stats.bytes += READ_ONCE(cpu_stats->bytes);
+    }
+
+    if (copy_to_user(arg, &stats, sizeof(stats)))
+        return -EFAULT;
+    return 0;
+}
+
 static long fifomailslot_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
     int minor;
     struct fifomailslot_dev *dev;
+    struct fifomailslot_session *session = filp->private_data;
 
     minor = iminor(filp->f_inode);
     dev = mailslot_devices[minor];
@@ -255,53 +747,345 @@ static long fifomailslot_ioctl(struct file *filp, unsigned int cmd, unsigned lon
 	switch(cmd){
 
 		case CHANGE_WRITE_BLOCKING_MODE_CTL:
-            printk(KERN_INFO "%s: chanching write blocking mode for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            printk(KERN_INFO "%s: chanching write blocking mode of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
 
             if(arg != 0 && arg != 1){
                 printk(KERN_ERR "%s: ERROR- invalid arguments for blocking mode (0 or 1)\n",DEVICE_NAME);
                 return -EINVAL;
                 }
 
-            dev->blocking_write = arg;
+            session->blocking_write = arg;
 			break;
 
         case CHANGE_READ_BLOCKING_MODE_CTL:
-            printk(KERN_INFO "%s: chanching read blocking mode for maislot with minor numer %d\n", DEVICE_NAME, minor);
+            printk(KERN_INFO "%s: chanching read blocking mode of the session for maislot with minor numer %d\n", DEVICE_NAME, minor);
 
             if(arg != 0 && arg!= 1){
                 printk(KERN_ERR "%s: ERROR- invalid arguments for blocking mode (0 or 1)\n", DEVICE_NAME);
                 return -EINVAL;
                 }
 
-            dev->blocking_read = arg;
+            session->blocking_read = arg;
 			break;
 
 		case CHANGE_MAX_DATA_UNIT_SIZE_CTL:
-            printk(KERN_INFO "%s: chanching maximum segment size for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            printk(KERN_INFO "%s: chanching maximum segment size of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
 
             if(arg < 1 || arg > MAX_DATA_UNIT_SIZE){
                 printk(KERN_ERR "%s: ERROR- invalid arguments for maximum segment size\n", DEVICE_NAME);
                 return -EINVAL;
                 }
 
-			dev->max_data_unit_size = arg;
+			session->max_data_unit_size = arg;
 			break;
 
 		case GET_MAX_DATA_UNIT_SIZE_CTL:
-            printk(KERN_INFO "%s: getting maximum segment size for mailslot with minor number %d\n",DEVICE_NAME, minor);
-            return dev->max_data_unit_size;
+            printk(KERN_INFO "%s: getting maximum segment size of the session for mailslot with minor number %d\n",DEVICE_NAME, minor);
+            return session->max_data_unit_size;
 
 		case GET_FREESPACE_SIZE_CTL:
             printk(KERN_INFO "%s: getting free space size for maislot with minor number %d\n", DEVICE_NAME, minor);
             return get_freespace(dev);
 
         case GET_WRITE_BLOCKING_MODE_CTL:
-            printk(KERN_INFO "%s: getting write blocking mode for mailslot with minor numer %d\n", DEVICE_NAME, minor);
-            return dev->blocking_write;
+            printk(KERN_INFO "%s: getting write blocking mode of the session for mailslot with minor numer %d\n", DEVICE_NAME, minor);
+            return session->blocking_write;
 
         case GET_READ_BLOCKING_MODE_CTL:
-            printk(KERN_INFO "%s: getting read blocking mode for mailslot with minor numer %d\n", DEVICE_NAME, minor);
-            return dev->blocking_read;
+            printk(KERN_INFO "%s: getting read blocking mode of the session for mailslot with minor numer %d\n", DEVICE_NAME, minor);
+            return session->blocking_read;
+
+        case CHANGE_SLOT_MODE_CTL:
+            printk(KERN_INFO "%s: changing slot mode for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg != FIFO_SLOT_MODE && arg != FANOUT_SLOT_MODE && arg != SHARDED_SLOT_MODE){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for slot mode\n", DEVICE_NAME);
+                return -EINVAL;
+                }
+
+            //the queue is interpreted differently in the two modes, so it can be switched only while empty
+            fifomailslot_lock_queue(dev);
+            if (!fifomailslot_is_empty(dev)){
+                mutex_unlock(&dev->mutex);
+                printk(KERN_ERR "%s: ERROR- the slot mode can be changed only on an empty mailslot\n", DEVICE_NAME);
+                return -EBUSY;
+                }
+            if (arg == SHARDED_SLOT_MODE && !dev->shards && fifomailslot_setup_shards(dev)){
+                mutex_unlock(&dev->mutex);
+                printk(KERN_ERR "%s: ERROR- cannot allocate the per cpu queues\n", DEVICE_NAME);
+                return -ENOMEM;
+                }
+            dev->head = NULL;
+            dev->tail = NULL;
+            WRITE_ONCE(dev->mode, arg);
+            mutex_unlock(&dev->mutex);
+            //the switch is allowed only on an empty slot, when readers are likely waiting in the old mode
+            wake_up_interruptible(&dev->readwq);
+            break;
+
+        case GET_SLOT_MODE_CTL:
+            printk(KERN_INFO "%s: getting slot mode for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return dev->mode;
+
+        case CHANGE_SLOW_SUBSCRIBER_POLICY_CTL:
+            printk(KERN_INFO "%s: changing slow subscriber policy for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg != SLOW_SUBSCRIBER_BLOCK && arg != SLOW_SUBSCRIBER_DROP && arg != SLOW_SUBSCRIBER_DISCONNECT){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for slow subscriber policy\n", DEVICE_NAME);
+                return -EINVAL;
+                }
+
+            mutex_lock(&dev->mutex);
+            dev->slow_subscriber_policy = arg;
+            mutex_unlock(&dev->mutex);
+            break;
+
+        case GET_SLOW_SUBSCRIBER_POLICY_CTL:
+            printk(KERN_INFO "%s: getting slow subscriber policy for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return dev->slow_subscriber_policy;
+
+        case GET_SUBSCRIBER_DROPPED_CTL:
+            printk(KERN_INFO "%s: getting dropped messages of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return session->dropped;
+
+        case CHANGE_BUSY_POLL_CTL:
+            printk(KERN_INFO "%s: changing busy poll budget of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg > MAX_BUSY_POLL_USECS){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for busy poll budget (0-%d usecs)\n", DEVICE_NAME, MAX_BUSY_POLL_USECS);
+                return -EINVAL;
+                }
+
+            if (!session->busy_poll_usecs && arg)
+                atomic_inc(&dev->busy_poll_sessions);
+            else if (session->busy_poll_usecs && !arg)
+                atomic_dec(&dev->busy_poll_sessions);
+            session->busy_poll_usecs = arg;
+            break;
+
+        case GET_BUSY_POLL_CTL:
+            printk(KERN_INFO "%s: getting busy poll budget of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return session->busy_poll_usecs;
+
+        case CHANGE_WRITE_BUSY_POLL_CTL:
+            printk(KERN_INFO "%s: changing write busy poll mode of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg != 0 && arg != 1){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for write busy poll mode (0 or 1)\n", DEVICE_NAME);
+                return -EINVAL;
+                }
+
+            session->busy_poll_write = arg;
+            break;
+
+        case GET_WRITE_BUSY_POLL_CTL:
+            printk(KERN_INFO "%s: getting write busy poll mode of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return session->busy_poll_write;
+
+        case CHANGE_READ_TIMEOUT_CTL:
+            printk(KERN_INFO "%s: changing read timeout of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            session->read_timeout = arg;
+            break;
+
+        case GET_READ_TIMEOUT_CTL:
+            printk(KERN_INFO "%s: getting read timeout of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return session->read_timeout;
+
+        case CHANGE_WRITE_TIMEOUT_CTL:
+            printk(KERN_INFO "%s: changing write timeout of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            session->write_timeout = arg;
+            break;
+
+        case GET_WRITE_TIMEOUT_CTL:
+            printk(KERN_INFO "%s: getting write timeout of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return session->write_timeout;
+
+        case CHANGE_SLOT_TTL_CTL:
+            printk(KERN_INFO "%s: changing message ttl for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            dev->ttl = arg;
+            break;
+
+        case GET_SLOT_TTL_CTL:
+            printk(KERN_INFO "%s: getting message ttl for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return dev->ttl;
+
+        case CHANGE_MESSAGE_TTL_CTL:
+            printk(KERN_INFO "%s: changing ttl of the messages of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            if (!session->message_ttl && arg)
+                atomic_inc(&dev->ttl_sessions);
+            else if (session->message_ttl && !arg)
+                atomic_dec(&dev->ttl_sessions);
+            session->message_ttl = arg;
+            break;
+
+        case GET_MESSAGE_TTL_CTL:
+            printk(KERN_INFO "%s: getting ttl of the messages of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return session->message_ttl;
+
+        case GET_EXPIRED_CTL:
+            printk(KERN_INFO "%s: getting number of expired messages for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return atomic_long_read(&dev->expired);
+
+        case CHANGE_BACKPRESSURE_POLICY_CTL:
+            printk(KERN_INFO "%s: changing backpressure policy for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg != BACKPRESSURE_BLOCK && arg != BACKPRESSURE_OVERWRITE){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for backpressure policy\n", DEVICE_NAME);
+                return -EINVAL;
+                }
+
+            dev->backpressure_policy = arg;
+            break;
+
+        case GET_BACKPRESSURE_POLICY_CTL:
+            printk(KERN_INFO "%s: getting backpressure policy for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return dev->backpressure_policy;
+
+        case GET_OVERWRITTEN_CTL:
+            printk(KERN_INFO "%s: getting number of overwritten messages for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return atomic_long_read(&dev->overwritten);
+
+        case CHANGE_SESSION_BYTE_QUOTA_CTL:
+            printk(KERN_INFO "%s: changing per session byte quota for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg > MAX_STORAGE){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for byte quota (0-%d)\n", DEVICE_NAME, MAX_STORAGE);
+                return -EINVAL;
+                }
+
+            mutex_lock(&dev->mutex);
+            dev->session_byte_quota = arg;
+            mutex_unlock(&dev->mutex);
+            wake_up_interruptible(&dev->wq);
+            break;
+
+        case GET_SESSION_BYTE_QUOTA_CTL:
+            printk(KERN_INFO "%s: getting per session byte quota for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return dev->session_byte_quota;
+
+        case CHANGE_SESSION_MSG_QUOTA_CTL:
+            printk(KERN_INFO "%s: changing per session message quota for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg > MAX_STORAGE){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for message quota (0-%d)\n", DEVICE_NAME, MAX_STORAGE);
+                return -EINVAL;
+                }
+
+            mutex_lock(&dev->mutex);
+            dev->session_msg_quota = arg;
+            mutex_unlock(&dev->mutex);
+            wake_up_interruptible(&dev->wq);
+            break;
+
+        case GET_SESSION_MSG_QUOTA_CTL:
+            printk(KERN_INFO "%s: getting per session message quota for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return dev->session_msg_quota;
+
+        case GET_QUEUED_BYTES_CTL:
+            printk(KERN_INFO "%s: getting queued bytes of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return session->queued_bytes;
+
+        case GET_QUEUED_MSGS_CTL:
+            printk(KERN_INFO "%s: getting queued messages of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return session->queued_msgs;
+
+        case GET_SESSION_STATS_CTL:
+            printk(KERN_INFO "%s: getting statistics of the session for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if (copy_to_user((void __user *)arg, &session->stats, sizeof(struct fifomailslot_session_stats))){
+                printk(KERN_ERR "%s: ERROR in the copy_to_user()",DEVICE_NAME);
+                return -EFAULT;
+                }
+            break;
+
+        case GROUP_RECEIVE_CTL:
+            printk(KERN_INFO "%s: group receive called by the process %d\n", DEVICE_NAME, current->pid);
+            return fifomailslot_group_receive(filp, (struct fifomailslot_group_receive __user *)arg);
+
+        case REGISTER_EVENTFD_CTL:
+            printk(KERN_INFO "%s: registering eventfd for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return fifomailslot_register_eventfd(session, (struct fifomailslot_eventfd __user *)arg);
+
+        case UNREGISTER_EVENTFD_CTL:
+            printk(KERN_INFO "%s: unregistering eventfd for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            //only the session that registered the eventfd drops it
+            fifomailslot_unregister_eventfd(dev, session);
+            break;
+
+        case CHANGE_CONSUMER_NODE_CTL:
+            printk(KERN_INFO "%s: changing consumer node for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            //NUMA_NO_NODE goes back to following the readers
+            if ((long)arg == NUMA_NO_NODE){
+                WRITE_ONCE(dev->track_consumer, 1);
+                break;
+                }
+            if(arg >= nr_node_ids || !node_online(arg)){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for consumer node, node %ld is not online\n", DEVICE_NAME, (long)arg);
+                return -EINVAL;
+                }
+
+            WRITE_ONCE(dev->track_consumer, 0);
+            WRITE_ONCE(dev->consumer_node, arg);
+            break;
+
+        case GET_CONSUMER_NODE_CTL:
+            printk(KERN_INFO "%s: getting consumer node for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return READ_ONCE(dev->consumer_node);
+
+        case GET_NODE_STATS_CTL:
+            printk(KERN_INFO "%s: getting per node allocation statistics for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return fifomailslot_get_node_stats(dev, (struct fifomailslot_node_stats __user *)arg);
+
+        case DRAIN_CTL:
+            printk(KERN_INFO "%s: draining mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return fifomailslot_dump(dev, (struct fifomailslot_dump __user *)arg, 1);
+
+        case SNAPSHOT_CTL:
+            printk(KERN_INFO "%s: taking a snapshot of mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return fifomailslot_dump(dev, (struct fifomailslot_dump __user *)arg, 0);
+
+        case RESTORE_CTL:
+            printk(KERN_INFO "%s: restoring messages into mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return fifomailslot_restore(dev, (struct fifomailslot_dump __user *)arg);
+
+        case CHANGE_ARENA_CTL:
+            printk(KERN_INFO "%s: changing small message arena for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg != 0 && arg != 1){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for arena (0-1)\n", DEVICE_NAME);
+                return -EINVAL;
+                }
+
+            if (arg)
+                WRITE_ONCE(dev->arena_enabled, 1);
+            else
+                fifomailslot_disable_arena(dev);
+            break;
+
+        case GET_ARENA_CTL:
+            printk(KERN_INFO "%s: getting small message arena for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return READ_ONCE(dev->arena_enabled);
+
+        case GET_ARENA_CHUNKS_CTL:
+            printk(KERN_INFO "%s: getting arena chunks for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return atomic_read(&dev->arena_chunks);
+
+        case CHANGE_SPSC_CTL:
+            printk(KERN_INFO "%s: changing single producer single consumer mode for mailslot with minor number %d\n", DEVICE_NAME, minor);
+
+            if(arg != 0 && arg != 1){
+                printk(KERN_ERR "%s: ERROR- invalid arguments for single producer single consumer mode (0-1)\n", DEVICE_NAME);
+                return -EINVAL;
+                }
+
+            WRITE_ONCE(dev->spsc_requested, arg);
+            fifomailslot_spsc_update(dev);
+            break;
+
+        case GET_SPSC_CTL:
+            printk(KERN_INFO "%s: getting single producer single consumer mode for mailslot with minor number %d\n", DEVICE_NAME, minor);
+            return READ_ONCE(dev->spsc_active);
 
 		default:
 			printk(KERN_ERR "%s : ERROR- inappropriate ioctl for device\n",DEVICE_NAME);
@@ -321,69 +1105,2030 @@ static struct file_operations fops = {
 };
 
 
+//the slot is allocated on the node given as module parameter, if any, or on the one of the caller
+static struct fifomailslot_dev *fifomailslot_alloc_dev(void){
+    int node = slot_node;
+    struct fifomailslot_dev *dev;
+
+    if (node < 0 || node >= nr_node_ids || !node_online(node))
+        node = numa_node_id();
+
+    dev = kzalloc_node(sizeof(struct fifomailslot_dev), GFP_KERNEL, node);
+    if (!dev)
+        return NULL;
+    dev->node_stats = __alloc_percpu(nr_node_ids * sizeof(struct fifomailslot_node_stats), __alignof__(struct fifomailslot_node_stats));
+    if (!dev->node_stats){
+        kfree(dev);
+        return NULL;
+    }
+    dev->consumer_node = node;
+    return dev;
+}
+
+static void fifomailslot_free_dev(struct fifomailslot_dev *dev){
+    free_percpu(dev->node_stats);
+    kfree(dev);
+}
+
 void setup_fifomailslot(struct fifomailslot_dev *dev, int minor){
     mutex_init(&dev->mutex);
     sema_init(&dev->readsem, 0);
     dev->minor = minor;
-    dev->blocking_write = 1;
-    dev->blocking_read = 1;
     dev->max_storage = MAX_STORAGE;
-    dev->max_data_unit_size = MAX_DATA_UNIT_SIZE;
     dev->no_msg.counter = 0;
     dev->no_sessions.counter = 0;
     dev->storage_size.counter = 0;
     init_waitqueue_head(&dev->wq);
+    dev->mode = FIFO_SLOT_MODE;
+    dev->slow_subscriber_policy = SLOW_SUBSCRIBER_BLOCK;
+    INIT_LIST_HEAD(&dev->subscribers);
+    init_waitqueue_head(&dev->readwq);
+    atomic_set(&dev->busy_poll_sessions, 0);
+    dev->ttl = 0;
+    atomic_long_set(&dev->expired, 0);
+    INIT_DELAYED_WORK(&dev->expire_work, fifomailslot_expire_work);
+    dev->backpressure_policy = BACKPRESSURE_BLOCK;
+    atomic_long_set(&dev->overwritten, 0);
+    dev->session_byte_quota = 0;
+    dev->session_msg_quota = 0;
+    dev->active_writers = 0;
+    atomic_set(&dev->waiting_within_share, 0);
+    spin_lock_init(&dev->notify_lock);
+    dev->notify_ctx = NULL;
+    dev->notify_owner = NULL;
+    dev->notify_armed = 0;
+    init_llist_head(&dev->kernel_pending);
+    INIT_WORK(&dev->kernel_work, fifomailslot_kernel_work);
+    dev->track_consumer = 1;
+    dev->consumer_candidate = NUMA_NO_NODE;
+    dev->candidate_reads = 0;
+    spin_lock_init(&dev->arena_lock);
+    dev->arena = NULL;
+    dev->arena_enabled = 0;
+    atomic_set(&dev->arena_chunks, 0);
+    atomic_set(&dev->reader_sessions, 0);
+    atomic_set(&dev->writer_sessions, 0);
+    dev->spsc_requested = 0;
+    dev->spsc_active = 0;
+    dev->spsc_stopping = 0;
+    atomic_set(&dev->ttl_sessions, 0);
+    dev->spsc = NULL;
 }
 
-long get_freespace(struct fifomailslot_dev * dev){
-    return dev->max_storage - atomic_long_read(&dev->storage_size);
+//converts a session timeout to jiffies for the *_timeout wait primitives, 0 means no timeout
+static long fifomailslot_timeout(unsigned long msecs){
+    if (!msecs || msecs_to_jiffies(msecs) >= MAX_SCHEDULE_TIMEOUT)
+        return MAX_SCHEDULE_TIMEOUT;
+    return msecs_to_jiffies(msecs);
 }
 
+//expiration time of a message written now by the session, 0 if it never expires
+static unsigned long fifomailslot_expiry(struct fifomailslot_session *session){
+    unsigned long ttl = session->message_ttl ? session->message_ttl : READ_ONCE(session->dev->ttl);
+    unsigned long expires;
 
-static int fifomailslot_wait_event_interruptible(struct fifomailslot_dev *dev, int required_space, struct fifomailslot_data * mesg_data, char* payload){
-
-    DEFINE_WAIT(wait);
+    if (!ttl)
+        return 0;
+    expires = jiffies + msecs_to_jiffies(ttl);
+    return expires ? expires : 1;
+}
 
-    printk(KERN_INFO "%s: write, current available space=%ld, required space=%d \n", DEVICE_NAME, get_freespace(dev), required_space);
-    while (get_freespace(dev) < required_space) {
-        printk(KERN_INFO "%s: write, there is no enough space to write \n", DEVICE_NAME);
-        mutex_unlock(&dev->mutex);
+static int fifomailslot_is_expired(struct fifomailslot_data *mesg_data){
+    return mesg_data->expires && time_after_eq(jiffies, mesg_data->expires);
+}
 
-        if (!dev->blocking_write) {
-            printk(KERN_ERR "%s: Non-blocking write and not enough space at the moment\n", DEVICE_NAME);
+/*
+ * The messages are allocated on the node of the consumer, so that the memcpy of the reader does
+ * not miss on remote memory. The node is either set by ioctl, for consumers pinned to a node, or
+ * it follows the readers; the first consumer node is the one the slot itself lives on.
+ */
+static struct fifomailslot_data *fifomailslot_alloc_message(struct fifomailslot_dev *dev, size_t len, gfp_t gfp){
+    int node = READ_ONCE(dev->consumer_node);
+    struct fifomailslot_data *mesg_data = NULL;
+
+    if (READ_ONCE(dev->arena_enabled) && len <= ARENA_MAX_MESSAGE_SIZE)
+        mesg_data = fifomailslot_arena_alloc(dev, len, gfp);
+
+    //the message is too large for the arena or no chunk could be allocated
+    if (!mesg_data){
+        mesg_data = kzalloc_node(sizeof(struct fifomailslot_data), gfp, node);
+        if (!mesg_data)
+            return NULL;
+        mesg_data->payload = kmalloc_node(sizeof(char)*len, gfp, node);
+        if (!mesg_data->payload){
             kfree(mesg_data);
-            kfree(payload);
-            return -EAGAIN;
+            return NULL;
         }
+    }
+    //the storage is charged with the length whatever the allocator, so the free space does not depend on the arena
+    mesg_data->len = len;
 
-        prepare_to_wait(&dev->wq, &wait, TASK_INTERRUPTIBLE);
+    //the allocator falls back to another node when the consumer's one is short of memory
+    node = page_to_nid(virt_to_page(mesg_data->payload));
+    this_cpu_inc(dev->node_stats[node].msgs);
+    this_cpu_add(dev->node_stats[node].bytes, len);
+    return mesg_data;
+}
 
-        if (get_freespace(dev) < required_space)
-            schedule();
+static void fifomailslot_free_message(struct fifomailslot_data *mesg_data){
+    if (mesg_data->arena){
+        fifomailslot_chunk_put(fifomailslot_chunk_of(mesg_data));
+        return;
+    }
+    kfree(mesg_data->payload);
+    kfree(mesg_data);
+}
 
-        finish_wait(&dev->wq, &wait);
+/*
+ * Called after a successful read. The consumer node moves only after CONSUMER_NODE_HYSTERESIS
+ * consecutive reads from another node, so readers on several nodes do not make it bounce along
+ * with its read mostly cache line. Nothing is written while the reads come from the consumer node.
+ * The counting is not serialized, concurrent readers may lose a count, which only delays the move.
+ */
+static void fifomailslot_track_consumer(struct fifomailslot_dev *dev){
+    int node;
+    int reads;
+
+    if (!READ_ONCE(dev->track_consumer))
+        return;
+    node = numa_node_id();
+    if (READ_ONCE(dev->consumer_node) == node){
+        if (READ_ONCE(dev->candidate_reads))
+            WRITE_ONCE(dev->candidate_reads, 0);
+        return;
+    }
+    if (READ_ONCE(dev->consumer_candidate) != node){
+        WRITE_ONCE(dev->consumer_candidate, node);
+        WRITE_ONCE(dev->candidate_reads, 1);
+        return;
+    }
+    reads = READ_ONCE(dev->candidate_reads) + 1;
+    if (reads < CONSUMER_NODE_HYSTERESIS){
+        WRITE_ONCE(dev->candidate_reads, reads);
+        return;
+    }
+    WRITE_ONCE(dev->consumer_node, node);
+    WRITE_ONCE(dev->candidate_reads, 0);
+}
 
-        if (signal_pending(current))
-            return -ERESTARTSYS;
+long get_freespace(struct fifomailslot_dev * dev){
+    if (dev->mode == SHARDED_SLOT_MODE)
+        return dev->max_storage - percpu_counter_sum(&dev->shard_storage_size);
+    return dev->max_storage - atomic_long_read(&dev->storage_size) - fifomailslot_spsc_bytes(dev);
+}
+
+
+/*
+ * Busy polling: the arrivals are timed with an exponentially weighted moving average of the
+ * interval between two messages. A reader spins at most twice the average interval and does not
+ * spin at all when the next message is not expected within its budget, so the cpu is burnt only
+ * when spinning is likely to avoid the sleep and the wakeup. The interval is kept racily in
+ * sharded mode, it is just a hint.
+ */
+
+static void fifomailslot_record_arrival(struct fifomailslot_dev *dev){
+    u64 now = local_clock();
+    u64 last = READ_ONCE(dev->last_arrival_ns);
+    u64 avg = READ_ONCE(dev->avg_interarrival_ns);
+    u64 interval = last ? now - last : 0;
+
+    WRITE_ONCE(dev->last_arrival_ns, now);
+    if (!last)
+        return;
+    WRITE_ONCE(dev->avg_interarrival_ns, avg ? avg - (avg >> 3) + (interval >> 3) : interval);
+}
+
+static u64 fifomailslot_read_poll_budget(struct fifomailslot_session *session){
+    u64 budget = (u64)session->busy_poll_usecs * NSEC_PER_USEC;
+    u64 avg = READ_ONCE(session->dev->avg_interarrival_ns);
+
+    //no history yet, try with the whole budget
+    if (!avg)
+        return budget;
+    if (avg > budget)
+        return 0;
+    return min(budget, 2 * avg);
+}
+
+/*
+ * Per session quotas and fair share: every queued message is charged to the session that wrote
+ * it. A session may not go beyond the byte and message quotas of the slot, and when writers
+ * compete for space the ones queueing more than max_storage/active_writers give way to the ones
+ * within their share. Called holding dev->mutex.
+ */
+
+static void fifomailslot_charge(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data){
+    struct fifomailslot_session *owner = mesg_data->owner;
+
+    if (!owner)
+        return;
+    if (owner->queued_msgs++ == 0)
+        dev->active_writers++;
+    owner->queued_bytes += mesg_data->len;
+}
+
+static void fifomailslot_uncharge(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data){
+    struct fifomailslot_session *owner = mesg_data->owner;
+
+    if (!owner)
+        return;
+    if (--owner->queued_msgs == 0)
+        dev->active_writers--;
+    owner->queued_bytes -= mesg_data->len;
+}
+
+//the session is being closed, its queued messages are not charged to anybody anymore
+static void fifomailslot_disown(struct fifomailslot_session *session){
+    struct fifomailslot_data *mesg_data;
+
+    for (mesg_data = session->dev->head; mesg_data; mesg_data = mesg_data->next){
+        if (mesg_data->owner == session)
+            mesg_data->owner = NULL;
+    }
+    if (session->queued_msgs)
+        session->dev->active_writers--;
+    session->queued_msgs = 0;
+    session->queued_bytes = 0;
+}
+
+static int fifomailslot_over_quota(struct fifomailslot_session *session, int required_space){
+    struct fifomailslot_dev *dev = session->dev;
+
+    if (dev->session_byte_quota && session->queued_bytes + required_space > dev->session_byte_quota)
+        return 1;
+    return dev->session_msg_quota && session->queued_msgs >= dev->session_msg_quota;
+}
+
+static int fifomailslot_within_fair_share(struct fifomailslot_session *session, int required_space){
+    struct fifomailslot_dev *dev = session->dev;
+    int writers = dev->active_writers + (session->queued_msgs ? 0 : 1);
+
+    return session->queued_bytes + required_space <= dev->max_storage / writers;
+}
+
+//without dev->mutex the answer is only a hint
+static int fifomailslot_may_write(struct fifomailslot_session *session, int required_space){
+    struct fifomailslot_dev *dev = session->dev;
+
+    if (get_freespace(dev) < required_space || fifomailslot_over_quota(session, required_space))
+        return 0;
+    if (dev->backpressure_policy == BACKPRESSURE_BLOCK && atomic_read(&dev->waiting_within_share) &&
+        !fifomailslot_within_fair_share(session, required_space))
+        return 0;
+    return 1;
+}
 
-        if (dev->blocking_write){
+//on a lossy slot a session beyond its quota replaces its own oldest messages. Called holding dev->mutex
+static void fifomailslot_overwrite_own(struct fifomailslot_session *session, int required_space){
+    struct fifomailslot_dev *dev = session->dev;
+    struct fifomailslot_data *prev, *mesg_data;
+
+    while (session->queued_msgs && fifomailslot_over_quota(session, required_space)){
+        prev = NULL;
+        for (mesg_data = dev->head; mesg_data->owner != session; mesg_data = mesg_data->next)
+            prev = mesg_data;
+        fifomailslot_remove_message(dev, prev, mesg_data);
+        atomic_long_inc(&dev->overwritten);
+    }
+}
+
+//the writers above their share may go on once nobody within its share is waiting anymore
+static void fifomailslot_leave_share(struct fifomailslot_dev *dev){
+    if (atomic_dec_and_test(&dev->waiting_within_share))
+        wake_up_interruptible(&dev->wq);
+}
+
+static int fifomailslot_wait_event_interruptible(struct fifomailslot_session *session, int required_space, int blocking_write, struct fifomailslot_data * mesg_data){
+    int ret = 0;
+    int share;
+    int within_share = 0;
+    struct fifomailslot_dev *dev = session->dev;
+    long timeout = fifomailslot_timeout(session->write_timeout);
+
+    DEFINE_WAIT(wait);
+
+    printk(KERN_INFO "%s: write, current available space=%ld, required space=%d \n", DEVICE_NAME, get_freespace(dev), required_space);
+    while (!fifomailslot_may_write(session, required_space)) {
+        printk(KERN_INFO "%s: write, there is no enough space to write or the session is beyond its quota\n", DEVICE_NAME);
+
+        //while this writer waits within its fair share, the ones above theirs hold back. The share
+        //shrinks as other writers become active, so it is evaluated again at every wakeup
+        share = !fifomailslot_over_quota(session, required_space) &&
+                fifomailslot_within_fair_share(session, required_space);
+        if (share && !within_share)
+            atomic_inc(&dev->waiting_within_share);
+        else if (!share && within_share)
+            fifomailslot_leave_share(dev);
+        within_share = share;
+
+        mutex_unlock(&dev->mutex);
+
+        if (!blocking_write) {
+            printk(KERN_ERR "%s: Non-blocking write and not enough space at the moment\n", DEVICE_NAME);
+            ret = -EAGAIN;
+            goto out;
+        }
+
+        if (!(session->busy_poll_write &&
+              fifomailslot_busy_poll((u64)session->busy_poll_usecs * NSEC_PER_USEC, fifomailslot_may_write(session, required_space)))){
+            prepare_to_wait(&dev->wq, &wait, TASK_INTERRUPTIBLE);
+
+            if (!fifomailslot_may_write(session, required_space))
+                timeout = schedule_timeout(timeout);
+
+            finish_wait(&dev->wq, &wait);
+        }
+
+        if (signal_pending(current)){
+            ret = -ERESTARTSYS;
+            goto out;
+        }
+
+        if (!timeout && !fifomailslot_may_write(session, required_space)){
+            printk(KERN_INFO "%s: write, process %d timed out\n", DEVICE_NAME, current->pid);
+            ret = -ETIMEDOUT;
+            goto out;
+        }
+
+        if (blocking_write){
             if (mutex_lock_interruptible(&dev->mutex)){
                 printk(KERN_INFO "%s: process %d woken up by a signal\n", DEVICE_NAME, current->pid);
-                return -ERESTARTSYS;
+                ret = -ERESTARTSYS;
+                goto out;
                 }
         }
         else{
             if (!mutex_trylock(&dev->mutex)) {
                 printk(KERN_ERR "%s: Resource not available\n", DEVICE_NAME);
-                kfree(mesg_data);
-                kfree(payload);
-                return -EAGAIN;
+                ret = -EAGAIN;
+                goto out;
                 }
         }
     }
+
+out:
+    if (within_share)
+        fifomailslot_leave_share(dev);
+
+    if (ret)
+        fifomailslot_free_message(mesg_data);
+    return ret;
+}
+
+
+/*
+ * Fan-out mode: the queue is shared by all the subscribers, each one has its own cursor on it.
+ * A message is stored once, its refcount is the number of subscribers that still have to read it
+ * and it is released when it drops to zero. Subscribers consume in order and a later message is
+ * never referenced by a subscriber that left before it was published, so the messages are always
+ * released from the head. All these functions must be called holding dev->mutex.
+ */
+
+static void fifomailslot_fanout_release_head(struct fifomailslot_dev *dev){
+    struct fifomailslot_data *temp;
+
+    while (dev->head && dev->head->refcount == 0){
+        temp = dev->head;
+        dev->head = temp->next;
+        if (!dev->head)
+            dev->tail = NULL;
+        atomic_long_sub(temp->len, &dev->storage_size);
+        atomic_dec(&dev->no_msg);
+        fifomailslot_uncharge(dev, temp);
+        fifomailslot_free_message(temp);
+    }
+}
+
+static void fifomailslot_fanout_publish(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data){
+    struct fifomailslot_session *session;
+
+    mesg_data->next = NULL;
+    mesg_data->refcount = 0;
+    list_for_each_entry(session, &dev->subscribers, subscriber_list){
+        mesg_data->refcount++;
+        if (!session->cursor)
+            session->cursor = mesg_data;
+    }
+
+    //nobody is listening, the message is simply lost
+    if (mesg_data->refcount == 0){
+        fifomailslot_free_message(mesg_data);
+        return;
+    }
+
+    if (dev->tail)
+        dev->tail->next = mesg_data;
+    else
+        dev->head = mesg_data;
+    dev->tail = mesg_data;
+
+    atomic_long_add(mesg_data->len, &dev->storage_size);
+    atomic_inc(&dev->no_msg);
+    fifomailslot_charge(dev, mesg_data);
+}
+
+static void fifomailslot_unsubscribe(struct fifomailslot_session *session){
+    struct fifomailslot_data *mesg_data;
+
+    for (mesg_data = session->cursor; mesg_data; mesg_data = mesg_data->next)
+        mesg_data->refcount--;
+    session->cursor = NULL;
+    list_del_init(&session->subscriber_list);
+    session->subscribed = 0;
+
+    fifomailslot_fanout_release_head(session->dev);
+}
+
+static void fifomailslot_fanout_make_room(struct fifomailslot_dev *dev, int required_space){
+    struct fifomailslot_session *session, *next;
+
+    while (dev->head && get_freespace(dev) < required_space){
+        //the subscribers pointing to the head are the ones keeping it alive
+        list_for_each_entry_safe(session, next, &dev->subscribers, subscriber_list){
+            if (session->cursor != dev->head)
+                continue;
+
+            if (dev->slow_subscriber_policy == SLOW_SUBSCRIBER_DISCONNECT){
+                printk(KERN_INFO "%s: slow subscriber disconnected from mailslot with minor number %d\n", DEVICE_NAME, dev->minor);
+                session->disconnected = 1;
+                fifomailslot_unsubscribe(session);
+            }
+            else{
+                session->cursor = dev->head->next;
+                dev->head->refcount--;
+                session->dropped++;
+            }
+        }
+        fifomailslot_fanout_release_head(dev);
+    }
+
+    //disconnected subscribers may be sleeping in read
+    wake_up_interruptible(&dev->readwq);
+}
+
+static ssize_t fifomailslot_fanout_read(struct fifomailslot_session *session, char *buff, size_t len, int blocking_read){
+    int mesg_len;
+    char aux[MAX_DATA_UNIT_SIZE];
+    long timeout = fifomailslot_timeout(session->read_timeout);
+    struct fifomailslot_dev *dev = session->dev;
+    struct fifomailslot_data *mesg_data;
+
+    if (!session->subscribed && !session->disconnected)
+        return -EBADF;
+
+    while (1){
+        if (blocking_read){
+            if (session->busy_poll_usecs)
+                fifomailslot_busy_poll(fifomailslot_read_poll_budget(session), READ_ONCE(session->cursor) || READ_ONCE(session->disconnected));
+            timeout = wait_event_interruptible_timeout(dev->readwq, READ_ONCE(session->cursor) || READ_ONCE(session->disconnected) ||
+                                                       READ_ONCE(dev->mode) != FANOUT_SLOT_MODE, timeout);
+            if (timeout == 0)
+                return -ETIMEDOUT;
+            if (timeout < 0){
+                printk(KERN_INFO "%s: process %d woken up by a signal read\n", DEVICE_NAME, current->pid);
+                return -ERESTARTSYS;
+                }
+            if (READ_ONCE(dev->mode) != FANOUT_SLOT_MODE)
+                return READ_MODE_CHANGED;
+            if (mutex_lock_interruptible(&dev->mutex)){
+                printk(KERN_INFO "%s: process %d woken up by a signal read\n", DEVICE_NAME, current->pid);
+                return -ERESTARTSYS;
+                }
+            }
+        else if (!mutex_trylock(&dev->mutex)){
+            printk(KERN_ERR "%s: read, resource not available\n", DEVICE_NAME);
+            return -EAGAIN;
+            }
+
+        if (session->disconnected){
+            mutex_unlock(&dev->mutex);
+            return -ECONNRESET;
+        }
+
+        if (fifomailslot_expire(dev, 0)){
+            wake_up_interruptible(&dev->wq);
+            fifomailslot_notify_space(dev);
+        }
+
+        if (session->cursor)
+            break;
+
+        mutex_unlock(&dev->mutex);
+        if (!blocking_read){
+            printk(KERN_ERR "%s: read, no message available right now\n",DEVICE_NAME);
+            return -EAGAIN;
+        }
+    }
+
+    mesg_data = session->cursor;
+    mesg_len = mesg_data->len;
+
+    if (len < mesg_len){
+        printk(KERN_ERR "%s: read, the buffer is too small\n", DEVICE_NAME);
+        mutex_unlock(&dev->mutex);
+        return -1;
+    }
+
+    memcpy(aux, mesg_data->payload, mesg_len);
+    session->cursor = mesg_data->next;
+    mesg_data->refcount--;
+    fifomailslot_fanout_release_head(dev);
+
+    mutex_unlock(&dev->mutex);
+    wake_up_interruptible(&dev->wq);
+    fifomailslot_notify_space(dev);
+
+    if (copy_to_user(buff, aux, mesg_len)){
+        printk(KERN_ERR "%s: ERROR in the copy_to_user()",DEVICE_NAME);
+        return -1;
+    }
+
+    fifomailslot_track_consumer(dev);
+    session->stats.msgs_read++;
+    session->stats.bytes_read += mesg_len;
+    return mesg_len;
+}
+
+
+/*
+ * Sharded mode: every cpu has its own queue protected by its own spinlock and the used storage is a
+ * per cpu counter, so writers and readers running on different cpus do not share any cache line.
+ * A session always writes into the queue of the cpu where it wrote the first time, so the messages
+ * of a session keep their order; readers serve their local queue first and then steal from the
+ * others. The queues are allocated on the first switch to sharded mode and kept until the module
+ * is removed, so a racing operation that still sees the old mode never touches freed memory.
+ */
+
+static int fifomailslot_setup_shards(struct fifomailslot_dev *dev){
+    int cpu;
+    struct fifomailslot_shard *shard;
+
+    dev->shards = alloc_percpu(struct fifomailslot_shard);
+    if (!dev->shards)
+        return -ENOMEM;
+
+    if (percpu_counter_init(&dev->shard_storage_size, 0, GFP_KERNEL)){
+        free_percpu(dev->shards);
+        dev->shards = NULL;
+        return -ENOMEM;
+    }
+
+    for_each_possible_cpu(cpu){
+        shard = per_cpu_ptr(dev->shards, cpu);
+        spin_lock_init(&shard->lock);
+        shard->head = NULL;
+        shard->tail = NULL;
+    }
+    return 0;
+}
+
+static int fifomailslot_sharded_pending(struct fifomailslot_dev *dev){
+    int cpu;
+
+    for_each_possible_cpu(cpu){
+        if (READ_ONCE(per_cpu_ptr(dev->shards, cpu)->head))
+            return 1;
+    }
     return 0;
 }
 
+/*
+ * The counters of the storage are checked too: fifomailslot_kernel_write() reserves the space of a
+ * message before linking it, and the reservation is charged to the counter of the mode it saw. A
+ * switch in between would leave the message charged to the counter of the other mode.
+ */
+static int fifomailslot_is_empty(struct fifomailslot_dev *dev){
+    if (atomic_read(&dev->no_msg) != 0 || !llist_empty(&dev->kernel_pending) || fifomailslot_spsc_pending(dev))
+        return 0;
+    if (atomic_long_read(&dev->storage_size) != 0)
+        return 0;
+    return !dev->shards || (!fifomailslot_sharded_pending(dev) && percpu_counter_sum(&dev->shard_storage_size) == 0);
+}
+
+//reserves the space for the message, the reservation is undone if it went beyond the maximum storage
+static int fifomailslot_sharded_reserve(struct fifomailslot_dev *dev, int required_space){
+    percpu_counter_add_batch(&dev->shard_storage_size, required_space, SHARD_STORAGE_BATCH);
+    if (__percpu_counter_compare(&dev->shard_storage_size, dev->max_storage, SHARD_STORAGE_BATCH) > 0){
+        percpu_counter_add_batch(&dev->shard_storage_size, -required_space, SHARD_STORAGE_BATCH);
+        return 0;
+    }
+    return 1;
+}
+
+//links a message whose space is already reserved at the tail of the queue of cpu
+static void fifomailslot_sharded_enqueue(struct fifomailslot_dev *dev, int cpu, struct fifomailslot_data *mesg_data){
+    struct fifomailslot_shard *shard = per_cpu_ptr(dev->shards, cpu);
+
+    mesg_data->next = NULL;
+    spin_lock(&shard->lock);
+    if (shard->tail)
+        shard->tail->next = mesg_data;
+    else
+        WRITE_ONCE(shard->head, mesg_data);
+    shard->tail = mesg_data;
+    spin_unlock(&shard->lock);
+}
+
+static ssize_t fifomailslot_sharded_write(struct fifomailslot_session *session, const char *buff, size_t len, int blocking_write){
+    int cpu;
+    struct fifomailslot_dev *dev = session->dev;
+    struct fifomailslot_data *mesg_data;
+    long timeout = fifomailslot_timeout(session->write_timeout);
+
+    if (len > session->max_data_unit_size || len == 0)
+        return -EMSGSIZE;
+
+    mesg_data = fifomailslot_alloc_message(dev, len, GFP_KERNEL);
+    if (!mesg_data)
+        return -ENOMEM;
+    if (copy_from_user(mesg_data->payload, buff, len)){
+        fifomailslot_free_message(mesg_data);
+        return -EFAULT;
+    }
+    mesg_data->len = len;
+    mesg_data->next = NULL;
+    mesg_data->owner = NULL;
+    mesg_data->expires = fifomailslot_expiry(session);
+    if (mesg_data->expires)
+        schedule_delayed_work(&dev->expire_work, msecs_to_jiffies(EXPIRE_SCAN_INTERVAL_MSECS));
+
+    while (!fifomailslot_sharded_reserve(dev, mesg_data->len)){
+        //with nothing left to evict the space is held by writers still linking their messages or
+        //readers still releasing theirs: the writer waits for it as with the other policies
+        if (dev->backpressure_policy == BACKPRESSURE_OVERWRITE && fifomailslot_sharded_overwrite_oldest(dev))
+            continue;
+        if (blocking_write && session->busy_poll_write &&
+            fifomailslot_busy_poll((u64)session->busy_poll_usecs * NSEC_PER_USEC, get_freespace(dev) >= mesg_data->len))
+            continue;
+        if (blocking_write)
+            timeout = wait_event_interruptible_timeout(dev->wq, get_freespace(dev) >= mesg_data->len, timeout);
+        if (!blocking_write || timeout <= 0){
+            fifomailslot_free_message(mesg_data);
+            if (!blocking_write)
+                return -EAGAIN;
+            return timeout ? -ERESTARTSYS : -ETIMEDOUT;
+        }
+    }
+
+    cpu = READ_ONCE(session->shard_cpu);
+    if (cpu < 0){
+        cpu = raw_smp_processor_id();
+        WRITE_ONCE(session->shard_cpu, cpu);
+    }
+    fifomailslot_sharded_enqueue(dev, cpu, mesg_data);
+
+    if (atomic_read(&dev->busy_poll_sessions))
+        fifomailslot_record_arrival(dev);
+
+    if (wq_has_sleeper(&dev->readwq))
+        wake_up_interruptible(&dev->readwq);
+    fifomailslot_notify_arrival(dev);
+
+    session->stats.msgs_written++;
+    session->stats.bytes_written += len;
+    return len;
+}
+
+//returns the dequeued message, NULL if all the queues are empty or ERR_PTR(-1) if the first message found does not fit
+static struct fifomailslot_data *fifomailslot_sharded_dequeue(struct fifomailslot_dev *dev, size_t len){
+    int i;
+    int cpu;
+    int local_cpu = raw_smp_processor_id();
+    struct fifomailslot_shard *shard;
+    struct fifomailslot_data *mesg_data;
+
+    for (i = 0; i < nr_cpu_ids; i++){
+        cpu = (local_cpu + i) % nr_cpu_ids;
+        if (!cpu_possible(cpu))
+            continue;
+        shard = per_cpu_ptr(dev->shards, cpu);
+
+        //peek without the lock so that empty queues of other cpus are not written
+        if (!READ_ONCE(shard->head))
+            continue;
+
+        spin_lock(&shard->lock);
+        while ((mesg_data = shard->head) && fifomailslot_is_expired(mesg_data)){
+            WRITE_ONCE(shard->head, mesg_data->next);
+            if (!mesg_data->next)
+                shard->tail = NULL;
+            percpu_counter_add_batch(&dev->shard_storage_size, -mesg_data->len, SHARD_STORAGE_BATCH);
+            atomic_long_inc(&dev->expired);
+            fifomailslot_free_message(mesg_data);
+        }
+        if (!mesg_data){
+            spin_unlock(&shard->lock);
+            continue;
+        }
+        if (len < mesg_data->len){
+            spin_unlock(&shard->lock);
+            return ERR_PTR(-1);
+        }
+        WRITE_ONCE(shard->head, mesg_data->next);
+        if (!mesg_data->next)
+            shard->tail = NULL;
+        spin_unlock(&shard->lock);
+        return mesg_data;
+    }
+    return NULL;
+}
+
+static ssize_t fifomailslot_sharded_read(struct fifomailslot_session *session, char *buff, size_t len, int blocking_read){
+    int mesg_len;
+    unsigned long not_copied;
+    long timeout = fifomailslot_timeout(session->read_timeout);
+    struct fifomailslot_dev *dev = session->dev;
+    struct fifomailslot_data *mesg_data;
+
+    while (!(mesg_data = fifomailslot_sharded_dequeue(dev, len))){
+        if (!blocking_read)
+            return -EAGAIN;
+        if (session->busy_poll_usecs &&
+            fifomailslot_busy_poll(fifomailslot_read_poll_budget(session), fifomailslot_sharded_pending(dev)))
+            continue;
+        timeout = wait_event_interruptible_timeout(dev->readwq, fifomailslot_sharded_pending(dev) ||
+                                                   READ_ONCE(dev->mode) != SHARDED_SLOT_MODE, timeout);
+        if (timeout == 0)
+            return -ETIMEDOUT;
+        if (timeout < 0)
+            return -ERESTARTSYS;
+        if (READ_ONCE(dev->mode) != SHARDED_SLOT_MODE)
+            return READ_MODE_CHANGED;
+    }
+
+    if (IS_ERR(mesg_data)){
+        printk(KERN_ERR "%s: read, the buffer is too small\n", DEVICE_NAME);
+        return -1;
+    }
+
+    mesg_len = mesg_data->len;
+    not_copied = copy_to_user(buff, mesg_data->payload, mesg_len);
+    percpu_counter_add_batch(&dev->shard_storage_size, -mesg_data->len, SHARD_STORAGE_BATCH);
+    fifomailslot_free_message(mesg_data);
+
+    if (wq_has_sleeper(&dev->wq))
+        wake_up_interruptible(&dev->wq);
+    fifomailslot_notify_space(dev);
+
+    if (not_copied){
+        printk(KERN_ERR "%s: ERROR in the copy_to_user()",DEVICE_NAME);
+        return -1;
+    }
+
+    fifomailslot_track_consumer(dev);
+    session->stats.msgs_read++;
+    session->stats.bytes_read += mesg_len;
+    return mesg_len;
+}
+
+
+/*
+ * Message expiry: expired messages are dropped lazily from the head when somebody dequeues and
+ * proactively, anywhere in the queue, by a periodic work item that runs while the slot holds
+ * messages with a ttl. The space they release wakes up the blocked writers.
+ */
+
+//unlinks and frees a message of the queue, prev is the message before it or NULL. Called holding dev->mutex
+static void fifomailslot_remove_message(struct fifomailslot_dev *dev, struct fifomailslot_data *prev, struct fifomailslot_data *mesg_data){
+    struct fifomailslot_session *session;
+    struct fifomailslot_data *next = mesg_data->next;
+
+    if (prev)
+        prev->next = next;
+    else
+        dev->head = next;
+    if (dev->tail == mesg_data)
+        dev->tail = prev;
+
+    if (dev->mode == FANOUT_SLOT_MODE){
+        list_for_each_entry(session, &dev->subscribers, subscriber_list){
+            if (session->cursor == mesg_data)
+                session->cursor = next;
+        }
+    }
+    //if a reader already owns the token of this message it will find the queue empty and wait again
+    else if (down_trylock(&dev->readsem))
+        printk(KERN_INFO "%s: the removed message was already promised to a reader\n", DEVICE_NAME);
+
+    atomic_long_sub(mesg_data->len, &dev->storage_size);
+    atomic_dec(&dev->no_msg);
+    fifomailslot_uncharge(dev, mesg_data);
+    fifomailslot_free_message(mesg_data);
+}
+
+//drops the expired messages at the head or in the whole queue, returns how many. Called holding dev->mutex
+static int fifomailslot_expire(struct fifomailslot_dev *dev, int whole_queue){
+    int count = 0;
+    struct fifomailslot_data *prev = NULL;
+    struct fifomailslot_data *mesg_data = dev->head;
+    struct fifomailslot_data *next;
+
+    while (mesg_data){
+        next = mesg_data->next;
+        if (fifomailslot_is_expired(mesg_data)){
+            fifomailslot_remove_message(dev, prev, mesg_data);
+            count++;
+        }
+        else if (!whole_queue)
+            break;
+        else
+            prev = mesg_data;
+        mesg_data = next;
+    }
+
+    if (count)
+        atomic_long_add(count, &dev->expired);
+    return count;
+}
+
+static int fifomailslot_sharded_expire(struct fifomailslot_dev *dev, int *pending){
+    int cpu;
+    int count = 0;
+    struct fifomailslot_shard *shard;
+    struct fifomailslot_data *prev, *mesg_data, *next;
+
+    for_each_possible_cpu(cpu){
+        shard = per_cpu_ptr(dev->shards, cpu);
+        spin_lock(&shard->lock);
+        prev = NULL;
+        for (mesg_data = shard->head; mesg_data; mesg_data = next){
+            next = mesg_data->next;
+            if (!fifomailslot_is_expired(mesg_data)){
+                *pending |= mesg_data->expires != 0;
+                prev = mesg_data;
+                continue;
+            }
+            if (prev)
+                prev->next = next;
+            else
+                WRITE_ONCE(shard->head, next);
+            if (shard->tail == mesg_data)
+                shard->tail = prev;
+            percpu_counter_add_batch(&dev->shard_storage_size, -mesg_data->len, SHARD_STORAGE_BATCH);
+            fifomailslot_free_message(mesg_data);
+            count++;
+        }
+        spin_unlock(&shard->lock);
+    }
+
+    if (count)
+        atomic_long_add(count, &dev->expired);
+    return count;
+}
+
+static void fifomailslot_expire_work(struct work_struct *work){
+    int count;
+    int pending = 0;
+    struct fifomailslot_data *mesg_data;
+    struct fifomailslot_dev *dev = container_of(to_delayed_work(work), struct fifomailslot_dev, expire_work);
+
+    mutex_lock(&dev->mutex);
+    count = fifomailslot_expire(dev, 1);
+    for (mesg_data = dev->head; mesg_data && !pending; mesg_data = mesg_data->next)
+        pending = mesg_data->expires != 0;
+    mutex_unlock(&dev->mutex);
+
+    if (dev->shards)
+        count += fifomailslot_sharded_expire(dev, &pending);
+
+    if (count){
+        printk(KERN_INFO "%s: %d messages expired on mailslot with minor number %d\n", DEVICE_NAME, count, dev->minor);
+        wake_up_interruptible(&dev->wq);
+        fifomailslot_notify_space(dev);
+    }
+
+    //keep scanning while there are messages that may still expire
+    if (pending)
+        schedule_delayed_work(&dev->expire_work, msecs_to_jiffies(EXPIRE_SCAN_INTERVAL_MSECS));
+}
+
+
+/*
+ * Overwrite backpressure: the slot behaves as a lossy ring, a writer short of space evicts
+ * messages from the head until its message fits.
+ */
+
+//called holding dev->mutex
+static void fifomailslot_overwrite_oldest(struct fifomailslot_dev *dev, int required_space){
+    int count = 0;
+
+    while (dev->head && get_freespace(dev) < required_space){
+        fifomailslot_remove_message(dev, NULL, dev->head);
+        count++;
+    }
+
+    if (count){
+        printk(KERN_INFO "%s: write, %d messages overwritten on mailslot with minor number %d\n", DEVICE_NAME, count, dev->minor);
+        atomic_long_add(count, &dev->overwritten);
+    }
+}
+
+//there is no global head in sharded mode, the victim is the oldest message of the first non empty queue from the local one
+static int fifomailslot_sharded_overwrite_oldest(struct fifomailslot_dev *dev){
+    struct fifomailslot_data *mesg_data;
+
+    mesg_data = fifomailslot_sharded_dequeue(dev, MAX_DATA_UNIT_SIZE);
+    if (IS_ERR_OR_NULL(mesg_data))
+        return 0;
+
+    percpu_counter_add_batch(&dev->shard_storage_size, -mesg_data->len, SHARD_STORAGE_BATCH);
+    atomic_long_inc(&dev->overwritten);
+    fifomailslot_free_message(mesg_data);
+    return 1;
+}
+
+
+/*
+ * Eventfd notification: a process multiplexing many slots with epoll registers an eventfd on each of
+ * them instead of keeping a reader blocked per slot. The events are edge triggered: NOTIFY_NOT_EMPTY
+ * is signalled once when the first message arrives and armed again only when the slot is seen empty,
+ * NOTIFY_SPACE once when the free space reaches the watermark and armed again only when it falls
+ * below it, so a burst of writes or reads costs a single wakeup. After a NOTIFY_NOT_EMPTY the
+ * consumer is expected to read until EAGAIN.
+ */
+
+static void fifomailslot_signal(struct fifomailslot_dev *dev, int event){
+    spin_lock(&dev->notify_lock);
+    if (dev->notify_ctx && (dev->notify_events & event))
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0)
+        eventfd_signal(dev->notify_ctx);
+#else
+        eventfd_signal(dev->notify_ctx, 1);
+#endif
+    spin_unlock(&dev->notify_lock);
+}
+
+//called after a message has been queued
+static void fifomailslot_notify_arrival(struct fifomailslot_dev *dev){
+    int events;
+    long watermark;
+
+    if (!READ_ONCE(dev->notify_ctx))
+        return;
+    events = READ_ONCE(dev->notify_events);
+    watermark = READ_ONCE(dev->notify_watermark);
+
+    if ((events & NOTIFY_NOT_EMPTY) && test_and_clear_bit(NOTIFY_NOT_EMPTY_ARMED, &dev->notify_armed))
+        fifomailslot_signal(dev, NOTIFY_NOT_EMPTY);
+
+    if ((events & NOTIFY_SPACE) && !test_bit(NOTIFY_SPACE_ARMED, &dev->notify_armed) && get_freespace(dev) < watermark){
+        set_bit(NOTIFY_SPACE_ARMED, &dev->notify_armed);
+        smp_mb__after_atomic();
+        //a reader may have freed the space before it saw the event armed
+        if (get_freespace(dev) >= watermark && test_and_clear_bit(NOTIFY_SPACE_ARMED, &dev->notify_armed))
+            fifomailslot_signal(dev, NOTIFY_SPACE);
+    }
+}
+
+//called after messages have been dequeued, expired or released
+static void fifomailslot_notify_space(struct fifomailslot_dev *dev){
+    int events;
+
+    if (!READ_ONCE(dev->notify_ctx))
+        return;
+    events = READ_ONCE(dev->notify_events);
+
+    if ((events & NOTIFY_SPACE) && test_bit(NOTIFY_SPACE_ARMED, &dev->notify_armed) &&
+        get_freespace(dev) >= READ_ONCE(dev->notify_watermark) && test_and_clear_bit(NOTIFY_SPACE_ARMED, &dev->notify_armed))
+        fifomailslot_signal(dev, NOTIFY_SPACE);
+
+    if ((events & NOTIFY_NOT_EMPTY) && !test_bit(NOTIFY_NOT_EMPTY_ARMED, &dev->notify_armed) && !fifomailslot_has_messages(dev)){
+        set_bit(NOTIFY_NOT_EMPTY_ARMED, &dev->notify_armed);
+        smp_mb__after_atomic();
+        //a writer may have queued a message before it saw the event armed
+        if (fifomailslot_has_messages(dev) && test_and_clear_bit(NOTIFY_NOT_EMPTY_ARMED, &dev->notify_armed))
+            fifomailslot_signal(dev, NOTIFY_NOT_EMPTY);
+    }
+}
+
+static long fifomailslot_register_eventfd(struct fifomailslot_session *session, struct fifomailslot_eventfd __user *arg){
+    struct fifomailslot_eventfd req;
+    struct fifomailslot_dev *dev = session->dev;
+    struct eventfd_ctx *ctx;
+    struct eventfd_ctx *old;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+    if (!req.events || (req.events & ~(NOTIFY_NOT_EMPTY | NOTIFY_SPACE)))
+        return -EINVAL;
+    if ((req.events & NOTIFY_SPACE) && (req.watermark <= 0 || req.watermark > dev->max_storage)){
+        printk(KERN_ERR "%s: ERROR- invalid arguments for the watermark (1-%ld)\n", DEVICE_NAME, dev->max_storage);
+        return -EINVAL;
+    }
+
+    ctx = eventfd_ctx_fdget(req.fd);
+    if (IS_ERR(ctx))
+        return PTR_ERR(ctx);
+
+    spin_lock(&dev->notify_lock);
+    old = dev->notify_ctx;
+    dev->notify_events = req.events;
+    dev->notify_watermark = req.watermark;
+    dev->notify_owner = session;
+    dev->notify_armed = 0;
+    set_bit(NOTIFY_NOT_EMPTY_ARMED, &dev->notify_armed);
+    WRITE_ONCE(dev->notify_ctx, ctx);
+    spin_unlock(&dev->notify_lock);
+
+    if (old)
+        eventfd_ctx_put(old);
+
+    //the messages already queued count as an arrival, the space is waited for only if it is below the watermark
+    smp_mb();
+    if (fifomailslot_has_messages(dev) && test_and_clear_bit(NOTIFY_NOT_EMPTY_ARMED, &dev->notify_armed))
+        fifomailslot_signal(dev, NOTIFY_NOT_EMPTY);
+    if ((req.events & NOTIFY_SPACE) && get_freespace(dev) < req.watermark){
+        set_bit(NOTIFY_SPACE_ARMED, &dev->notify_armed);
+        smp_mb__after_atomic();
+        fifomailslot_notify_space(dev);
+    }
+    return 0;
+}
+
+//drops the registration if it belongs to owner, another session cannot remove it
+static void fifomailslot_unregister_eventfd(struct fifomailslot_dev *dev, struct fifomailslot_session *owner){
+    struct eventfd_ctx *ctx = NULL;
+
+    spin_lock(&dev->notify_lock);
+    if (dev->notify_owner == owner){
+        ctx = dev->notify_ctx;
+        WRITE_ONCE(dev->notify_ctx, NULL);
+        dev->notify_owner = NULL;
+    }
+    spin_unlock(&dev->notify_lock);
+
+    if (ctx)
+        eventfd_ctx_put(ctx);
+}
+
+
+/*
+ * In-kernel API: other modules produce and consume messages without going through the VFS. A slot
+ * is looked up once by minor, the returned pointer stays valid until this module is removed.
+ * fifomailslot_kernel_write() never waits for space, it fails with EAGAIN like a non blocking write.
+ * With a gfp that allows sleeping the message is queued before it returns; otherwise (GFP_ATOMIC,
+ * softirq and interrupt context) its space is reserved at once but the message is linked by a
+ * work item, since the FIFO and fan-out queues are protected by a mutex. fifomailslot_kernel_read()
+ * takes that mutex too and must be called from process context. Kernel messages are not charged
+ * to any session quota.
+ */
+
+struct fifomailslot_dev *fifomailslot_lookup(int minor){
+    if (minor < 0 || minor >= MAX_MINOR_NUMBER)
+        return NULL;
+    return READ_ONCE(mailslot_devices[minor]);
+}
+EXPORT_SYMBOL_GPL(fifomailslot_lookup);
+
+/*
+ * Reserves len bytes of the storage without any lock, as fifomailslot_sharded_reserve() does for
+ * sharded slots. A user write checks the space under dev->mutex and accounts it later, so a
+ * reservation landing in between may take the storage beyond the maximum by one message.
+ */
+static int fifomailslot_atomic_reserve(struct fifomailslot_dev *dev, size_t len){
+    long used = atomic_long_read(&dev->storage_size);
+    long ring = fifomailslot_spsc_bytes(dev);
+
+    do {
+        if (used + ring + (long)len > dev->max_storage)
+            return 0;
+    } while (!atomic_long_try_cmpxchg(&dev->storage_size, &used, used + len));
+    return 1;
+}
+
+/*
+ * Links a message whose space is already accounted and tells the readers. The mode may have
+ * changed between the moment the writer looked at it and its reservation, the charge is then moved
+ * to the counter of the current mode. It cannot change after the reservation: a switch needs both
+ * counters to be zero.
+ */
+static void fifomailslot_kernel_enqueue(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data){
+    //next shares its room with kernel_node, which the message no longer needs
+    mesg_data->next = NULL;
+    if (mesg_data->expires)
+        schedule_delayed_work(&dev->expire_work, msecs_to_jiffies(EXPIRE_SCAN_INTERVAL_MSECS));
+
+    if (READ_ONCE(dev->mode) == SHARDED_SLOT_MODE){
+        if (!mesg_data->shard_charged){
+            percpu_counter_add_batch(&dev->shard_storage_size, mesg_data->len, SHARD_STORAGE_BATCH);
+            atomic_long_sub(mesg_data->len, &dev->storage_size);
+        }
+        fifomailslot_sharded_enqueue(dev, raw_smp_processor_id(), mesg_data);
+    }
+    else{
+        if (mesg_data->shard_charged){
+            atomic_long_add(mesg_data->len, &dev->storage_size);
+            percpu_counter_add_batch(&dev->shard_storage_size, -mesg_data->len, SHARD_STORAGE_BATCH);
+        }
+        fifomailslot_lock_queue(dev);
+        if (atomic_read(&dev->busy_poll_sessions))
+            fifomailslot_record_arrival(dev);
+        if (dev->mode == FANOUT_SLOT_MODE){
+            //the publication accounts the space again, or frees the message if nobody is subscribed
+            atomic_long_sub(mesg_data->len, &dev->storage_size);
+            fifomailslot_fanout_publish(dev, mesg_data);
+        }
+        else
+            fifomailslot_enqueue_locked(dev, mesg_data);
+        mutex_unlock(&dev->mutex);
+    }
+
+    if (wq_has_sleeper(&dev->readwq))
+        wake_up_interruptible(&dev->readwq);
+    fifomailslot_notify_arrival(dev);
+}
+
+static void fifomailslot_kernel_work(struct work_struct *work){
+    struct fifomailslot_data *mesg_data, *next;
+    struct llist_node *pending;
+    struct fifomailslot_dev *dev = container_of(work, struct fifomailslot_dev, kernel_work);
+
+    //the list is filled from its head, reversing it restores the order of the writes
+    pending = llist_reverse_order(llist_del_all(&dev->kernel_pending));
+    llist_for_each_entry_safe(mesg_data, next, pending, kernel_node)
+        fifomailslot_kernel_enqueue(dev, mesg_data);
+}
+
+ssize_t fifomailslot_kernel_write(struct fifomailslot_dev *dev, const void *buf, size_t len, gfp_t gfp){
+    int reserved;
+    int mode = READ_ONCE(dev->mode);
+    int can_sleep = gfpflags_allow_blocking(gfp);
+    struct fifomailslot_data *mesg_data;
+
+    if (len > MAX_DATA_UNIT_SIZE || len == 0)
+        return -EMSGSIZE;
+
+    mesg_data = fifomailslot_alloc_message(dev, len, gfp);
+    if (!mesg_data)
+        return -ENOMEM;
+    memcpy(mesg_data->payload, buf, len);
+    mesg_data->len = len;
+    mesg_data->next = NULL;
+    mesg_data->owner = NULL;
+    mesg_data->refcount = 0;
+    mesg_data->shard_charged = mode == SHARDED_SLOT_MODE;
+    mesg_data->expires = dev->ttl ? jiffies + msecs_to_jiffies(dev->ttl) : 0;
+
+    if (mode == SHARDED_SLOT_MODE){
+        reserved = fifomailslot_sharded_reserve(dev, mesg_data->len);
+        if (!reserved && can_sleep && dev->backpressure_policy == BACKPRESSURE_OVERWRITE){
+            while (!reserved && fifomailslot_sharded_overwrite_oldest(dev))
+                reserved = fifomailslot_sharded_reserve(dev, mesg_data->len);
+        }
+    }
+    else if (can_sleep && dev->backpressure_policy == BACKPRESSURE_OVERWRITE){
+        mutex_lock(&dev->mutex);
+        fifomailslot_overwrite_oldest(dev, mesg_data->len);
+        reserved = fifomailslot_atomic_reserve(dev, mesg_data->len);
+        mutex_unlock(&dev->mutex);
+    }
+    else
+        reserved = fifomailslot_atomic_reserve(dev, mesg_data->len);
+
+    if (!reserved){
+        fifomailslot_free_message(mesg_data);
+        return -EAGAIN;
+    }
+
+    if (can_sleep)
+        fifomailslot_kernel_enqueue(dev, mesg_data);
+    else if (llist_add(&mesg_data->kernel_node, &dev->kernel_pending))
+        schedule_work(&dev->kernel_work);
+    return len;
+}
+EXPORT_SYMBOL_GPL(fifomailslot_kernel_write);
+
+ssize_t fifomailslot_kernel_read(struct fifomailslot_dev *dev, void *buf, size_t len){
+    ssize_t ret;
+
+    might_sleep();
+    ret = fifomailslot_try_dequeue(dev, buf, len);
+    if (ret > 0)
+        fifomailslot_track_consumer(dev);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(fifomailslot_kernel_read);
+
+
+/*
+ * Drain, snapshot and restore: the messages of a slot are moved in and out in one call, in the
+ * format described in linux_mail_slot.h. A drain stops when the buffer is full and sets
+ * FIFOMAILSLOT_DUMP_TRUNCATED, the caller repeats it until the flag is clear. A restore is all or
+ * nothing: the space of all its messages is reserved at once. Restored messages are not charged
+ * to the session quotas, as the ones of the in-kernel API.
+ */
+
+//the largest dump of a slot: every byte of the storage in a message of its own
+static size_t fifomailslot_dump_max_size(struct fifomailslot_dev *dev){
+    return sizeof(struct fifomailslot_dump_header) + dev->max_storage * (1 + sizeof(struct fifomailslot_dump_record));
+}
+
+//appends a message to a dump, returns 0 if it does not fit
+static int fifomailslot_dump_message(char *buf, size_t size, size_t *offset, struct fifomailslot_data *mesg_data){
+    struct fifomailslot_dump_record record;
+
+    if (*offset + sizeof(record) + mesg_data->len > size)
+        return 0;
+    record.len = mesg_data->len;
+    memcpy(buf + *offset, &record, sizeof(record));
+    memcpy(buf + *offset + sizeof(record), mesg_data->payload, mesg_data->len);
+    *offset += sizeof(record) + mesg_data->len;
+    return 1;
+}
+
+static long fifomailslot_dump(struct fifomailslot_dev *dev, struct fifomailslot_dump __user *arg, int drain){
+    int cpu;
+    int ret;
+    int mode = FIFO_SLOT_MODE;
+    char *buf;
+    size_t size;
+    size_t offset;
+    struct fifomailslot_dump req;
+    struct fifomailslot_dump_header header;
+    struct fifomailslot_dump_record record;
+    struct fifomailslot_shard *shard;
+    struct fifomailslot_data *mesg_data;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+    if (req.len < sizeof(header))
+        return -EINVAL;
+    //fan-out messages belong to the subscribers, they can only be looked at
+    if (drain && dev->mode == FANOUT_SLOT_MODE)
+        return -EINVAL;
+
+    size = min(req.len, fifomailslot_dump_max_size(dev));
+    buf = kvmalloc(size, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+
+    header.magic = FIFOMAILSLOT_DUMP_MAGIC;
+    header.version = FIFOMAILSLOT_DUMP_VERSION;
+    header.flags = 0;
+    header.count = 0;
+    offset = sizeof(header);
+
+    if (drain){
+        //the messages are gone once taken, the buffer of the caller is checked before
+        if (fault_in_writeable(req.buff, size)){
+            printk(KERN_ERR "%s: ERROR the drain buffer is not writable\n", DEVICE_NAME);
+            kvfree(buf);
+            return -EFAULT;
+        }
+        mode = READ_ONCE(dev->mode);
+        while (offset + sizeof(record) < size){
+            ret = fifomailslot_try_dequeue(dev, buf + offset + sizeof(record), min_t(size_t, size - offset - sizeof(record), MAX_DATA_UNIT_SIZE));
+            if (ret < 0)
+                break;
+            record.len = ret;
+            memcpy(buf + offset, &record, sizeof(record));
+            offset += sizeof(record) + ret;
+            header.count++;
+        }
+        if (fifomailslot_has_messages(dev))
+            header.flags |= FIFOMAILSLOT_DUMP_TRUNCATED;
+    }
+    else if (dev->mode == SHARDED_SLOT_MODE){
+        for_each_possible_cpu(cpu){
+            shard = per_cpu_ptr(dev->shards, cpu);
+            spin_lock(&shard->lock);
+            for (mesg_data = shard->head; mesg_data; mesg_data = mesg_data->next){
+                if (fifomailslot_is_expired(mesg_data))
+                    continue;
+                if (!fifomailslot_dump_message(buf, size, &offset, mesg_data)){
+                    header.flags |= FIFOMAILSLOT_DUMP_TRUNCATED;
+                    break;
+                }
+                header.count++;
+            }
+            spin_unlock(&shard->lock);
+            if (header.flags & FIFOMAILSLOT_DUMP_TRUNCATED)
+                break;
+        }
+    }
+    else{
+        //the ring is not walked, its messages are moved to the queue first
+        fifomailslot_lock_queue(dev);
+        for (mesg_data = dev->head; mesg_data; mesg_data = mesg_data->next){
+            if (fifomailslot_is_expired(mesg_data))
+                continue;
+            if (!fifomailslot_dump_message(buf, size, &offset, mesg_data)){
+                header.flags |= FIFOMAILSLOT_DUMP_TRUNCATED;
+                break;
+            }
+            header.count++;
+        }
+        mutex_unlock(&dev->mutex);
+    }
+
+    header.size = offset;
+    memcpy(buf, &header, sizeof(header));
+
+    ret = offset;
+    if (copy_to_user(req.buff, buf, offset)){
+        printk(KERN_ERR "%s: ERROR in the copy_to_user()",DEVICE_NAME);
+        if (drain)
+            fifomailslot_requeue(dev, buf, offset, header.count, mode);
+        ret = -EFAULT;
+    }
+    kvfree(buf);
+    return ret;
+}
+
+/*
+ * Allocates the messages of the count records of a dump that starts at buf and ends at buf + size,
+ * linked through next with *last the final one and *total their length. Every message is allocated
+ * before any of them is queued, so that a bad record leaves the slot untouched. Returns the first
+ * message, NULL if count is 0, or an ERR_PTR.
+ */
+static struct fifomailslot_data *fifomailslot_dump_messages(struct fifomailslot_dev *dev, char *buf, size_t size, unsigned int count,
+                                                            struct fifomailslot_data **last, long *total){
+    unsigned int i;
+    size_t offset = sizeof(struct fifomailslot_dump_header);
+    struct fifomailslot_dump_record record;
+    struct fifomailslot_data *mesg_data, *next;
+    struct fifomailslot_data *first = NULL;
+    long ret;
+
+    *last = NULL;
+    *total = 0;
+    for (i = 0; i < count; i++){
+        if (offset + sizeof(record) > size)
+            goto invalid;
+        memcpy(&record, buf + offset, sizeof(record));
+        offset += sizeof(record);
+        if (record.len == 0 || record.len > MAX_DATA_UNIT_SIZE || offset + record.len > size)
+            goto invalid;
+
+        mesg_data = fifomailslot_alloc_message(dev, record.len, GFP_KERNEL);
+        if (!mesg_data){
+            ret = -ENOMEM;
+            goto out;
+        }
+        memcpy(mesg_data->payload, buf + offset, record.len);
+        mesg_data->next = NULL;
+        mesg_data->expires = dev->ttl ? jiffies + msecs_to_jiffies(dev->ttl) : 0;
+        if (*last)
+            (*last)->next = mesg_data;
+        else
+            first = mesg_data;
+        *last = mesg_data;
+        offset += record.len;
+        *total += mesg_data->len;
+    }
+    if (offset != size)
+        goto invalid;
+    return first;
+
+invalid:
+    printk(KERN_ERR "%s: ERROR- invalid dump record %u\n", DEVICE_NAME, i);
+    ret = -EINVAL;
+out:
+    for (mesg_data = first; mesg_data; mesg_data = next){
+        next = mesg_data->next;
+        fifomailslot_free_message(mesg_data);
+    }
+    return ERR_PTR(ret);
+}
+
+static void fifomailslot_free_messages(struct fifomailslot_data *first){
+    struct fifomailslot_data *next;
+
+    for (; first; first = next){
+        next = first->next;
+        fifomailslot_free_message(first);
+    }
+}
+
+static int fifomailslot_dump_reserve(struct fifomailslot_dev *dev, long total){
+    if (dev->mode == SHARDED_SLOT_MODE)
+        return fifomailslot_sharded_reserve(dev, total);
+    return fifomailslot_atomic_reserve(dev, total);
+}
+
+/*
+ * A drain whose copy to the caller failed puts its messages back at the head of the slot, in their
+ * order, so that they are not lost. Writers may have taken their space in the meantime, or the
+ * slot may have left its mode: the messages are dropped then, and a message that had a ttl gets
+ * the one of the slot again, as a restored one.
+ */
+static void fifomailslot_requeue(struct fifomailslot_dev *dev, char *buf, size_t size, unsigned int count, int mode){
+    long total;
+    unsigned int i;
+    struct fifomailslot_shard *shard;
+    struct fifomailslot_data *first, *last;
+
+    first = fifomailslot_dump_messages(dev, buf, size, count, &last, &total);
+    if (IS_ERR_OR_NULL(first))
+        goto lost;
+    if (READ_ONCE(dev->mode) != mode ||
+        !(mode == SHARDED_SLOT_MODE ? fifomailslot_sharded_reserve(dev, total) : fifomailslot_atomic_reserve(dev, total))){
+        fifomailslot_free_messages(first);
+        goto lost;
+    }
+
+    if (mode == SHARDED_SLOT_MODE){
+        shard = per_cpu_ptr(dev->shards, raw_smp_processor_id());
+        spin_lock(&shard->lock);
+        last->next = shard->head;
+        if (!shard->head)
+            shard->tail = last;
+        WRITE_ONCE(shard->head, first);
+        spin_unlock(&shard->lock);
+    }
+    else{
+        fifomailslot_lock_queue(dev);
+        if (dev->mode != mode){
+            mutex_unlock(&dev->mutex);
+            atomic_long_sub(total, &dev->storage_size);
+            fifomailslot_free_messages(first);
+            goto lost;
+        }
+        if (atomic_read(&dev->no_msg) == 0)
+            dev->tail = last;
+        else
+            last->next = dev->head;
+        dev->head = first;
+        for (i = 0; i < count; i++){
+            atomic_inc(&dev->no_msg);
+            up(&dev->readsem);
+        }
+        mutex_unlock(&dev->mutex);
+    }
+
+    printk(KERN_INFO "%s: drain, %u messages put back on mailslot with minor number %d\n", DEVICE_NAME, count, dev->minor);
+    if (wq_has_sleeper(&dev->readwq))
+        wake_up_interruptible(&dev->readwq);
+    fifomailslot_notify_arrival(dev);
+    return;
+
+lost:
+    printk(KERN_ERR "%s: drain, %u messages of mailslot with minor number %d could not be put back\n", DEVICE_NAME, count, dev->minor);
+}
+
+static long fifomailslot_restore(struct fifomailslot_dev *dev, struct fifomailslot_dump __user *arg){
+    char *buf;
+    long total;
+    struct fifomailslot_dump req;
+    struct fifomailslot_dump_header header;
+    struct fifomailslot_data *mesg_data, *next;
+    struct fifomailslot_data *first, *last;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+    if (req.len < sizeof(header) || req.len > fifomailslot_dump_max_size(dev))
+        return -EINVAL;
+
+    buf = kvmalloc(req.len, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+    if (copy_from_user(buf, req.buff, req.len)){
+        kvfree(buf);
+        return -EFAULT;
+    }
+
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != FIFOMAILSLOT_DUMP_MAGIC || header.version != FIFOMAILSLOT_DUMP_VERSION ||
+        header.size < sizeof(header) || header.size > req.len){
+        printk(KERN_ERR "%s: ERROR- invalid dump header\n", DEVICE_NAME);
+        kvfree(buf);
+        return -EINVAL;
+    }
+
+    first = fifomailslot_dump_messages(dev, buf, header.size, header.count, &last, &total);
+    kvfree(buf);
+    if (IS_ERR(first))
+        return PTR_ERR(first);
+
+    if (!fifomailslot_dump_reserve(dev, total)){
+        printk(KERN_ERR "%s: restore, not enough space for %ld bytes\n", DEVICE_NAME, total);
+        fifomailslot_free_messages(first);
+        return -EAGAIN;
+    }
+
+    for (mesg_data = first; mesg_data; mesg_data = next){
+        next = mesg_data->next;
+        fifomailslot_kernel_enqueue(dev, mesg_data);
+    }
+    return header.count;
+}
+
+
+/*
+ * Small message arena: messages of up to ARENA_MAX_MESSAGE_SIZE bytes are carved, header and
+ * payload together, out of page sized chunks with a bump pointer. A burst of small messages then
+ * takes a few contiguous pages instead of two slab objects each, and a reader walks them in
+ * memory order. A chunk goes back to the page allocator when its last message is freed. A chunk
+ * is a page and starts with its header, so a message finds its chunk from its own address.
+ */
+
+#define FIFOMAILSLOT_CHUNK_HEADER ALIGN(sizeof(struct fifomailslot_chunk), ARENA_ALIGN)
+
+static struct fifomailslot_chunk *fifomailslot_chunk_of(struct fifomailslot_data *mesg_data){
+    return (struct fifomailslot_chunk *)((unsigned long)mesg_data & PAGE_MASK);
+}
+
+//hands out size bytes of chunk, NULL if they do not fit. Called holding dev->arena_lock
+static struct fifomailslot_data *fifomailslot_arena_carve(struct fifomailslot_chunk *chunk, unsigned int size){
+    struct fifomailslot_data *mesg_data;
+
+    if (!chunk)
+        return NULL;
+    //only the arena holds the chunk, every message in it has been consumed and it can be filled again
+    if (atomic_read(&chunk->refcount) == 1)
+        chunk->used = FIFOMAILSLOT_CHUNK_HEADER;
+    if (chunk->used + size > PAGE_SIZE)
+        return NULL;
+
+    mesg_data = (struct fifomailslot_data *)((char *)chunk + chunk->used);
+    chunk->used += size;
+    atomic_inc(&chunk->refcount);
+
+    memset(mesg_data, 0, sizeof(struct fifomailslot_data));
+    mesg_data->arena = 1;
+    mesg_data->payload = (char *)(mesg_data + 1);
+    return mesg_data;
+}
+
+static struct fifomailslot_data *fifomailslot_arena_alloc(struct fifomailslot_dev *dev, size_t len, gfp_t gfp){
+    unsigned long flags;
+    struct page *page;
+    struct fifomailslot_chunk *chunk;
+    struct fifomailslot_chunk *old;
+    struct fifomailslot_data *mesg_data;
+    unsigned int size = ALIGN(sizeof(struct fifomailslot_data) + len, ARENA_ALIGN);
+
+    spin_lock_irqsave(&dev->arena_lock, flags);
+    mesg_data = fifomailslot_arena_carve(dev->arena, size);
+    spin_unlock_irqrestore(&dev->arena_lock, flags);
+    if (mesg_data)
+        return mesg_data;
+
+    //the page might be allocated sleeping, so the chunk is replaced in a second critical section
+    page = alloc_pages_node(READ_ONCE(dev->consumer_node), gfp, 0);
+    if (!page)
+        return NULL;
+    chunk = page_address(page);
+    atomic_set(&chunk->refcount, 1);
+    chunk->used = FIFOMAILSLOT_CHUNK_HEADER;
+    chunk->dev = dev;
+    atomic_inc(&dev->arena_chunks);
+
+    spin_lock_irqsave(&dev->arena_lock, flags);
+    old = dev->arena;
+    dev->arena = chunk;
+    mesg_data = fifomailslot_arena_carve(chunk, size);
+    spin_unlock_irqrestore(&dev->arena_lock, flags);
+
+    if (old)
+        fifomailslot_chunk_put(old);
+    return mesg_data;
+}
+
+static void fifomailslot_chunk_put(struct fifomailslot_chunk *chunk){
+    struct fifomailslot_dev *dev = chunk->dev;
+
+    if (atomic_dec_and_test(&chunk->refcount)){
+        free_page((unsigned long)chunk);
+        atomic_dec(&dev->arena_chunks);
+    }
+}
+
+//the chunk being filled is released once its messages are consumed, new messages are kmalloc'ed
+static void fifomailslot_disable_arena(struct fifomailslot_dev *dev){
+    unsigned long flags;
+    struct fifomailslot_chunk *chunk;
+
+    spin_lock_irqsave(&dev->arena_lock, flags);
+    WRITE_ONCE(dev->arena_enabled, 0);
+    chunk = dev->arena;
+    dev->arena = NULL;
+    spin_unlock_irqrestore(&dev->arena_lock, flags);
+
+    if (chunk)
+        fifomailslot_chunk_put(chunk);
+}
+
+
+/*
+ * Point-to-point slots: a FIFO slot with one writer session and one reader session, or one the
+ * slot was told to treat so with CHANGE_SPSC_CTL, moves its messages through a ring instead of the
+ * queue. The producer only writes the tail and the consumer only the head, both published with
+ * release semantics, so neither dev->mutex nor dev->readsem is taken and the two sides never
+ * contend on a lock. A side sleeps only on an empty (reader) or full (writer) ring, and the other
+ * side wakes it only on the transition out of that state. The ring keeps neither ttl nor quotas:
+ * the slot goes back to the queue, with the messages of the ring moved at its tail, at the first
+ * write after they are set, or as soon as a third session opens, the slot mode changes or a
+ * message is linked or walked in the queue directly (in-kernel writes, restore, snapshot); the
+ * in-kernel reads, drain and group receive consume from the ring instead. The ring is started
+ * again when a session is opened or closed, by CHANGE_SPSC_CTL, or once the reader has emptied
+ * the queue. The ring and the queue are never used at the same time: the ring is started only
+ * while the queue is empty, and stopping it waits (RCU) for the operations that saw it active to
+ * be done with it.
+ */
+
+//pairs with the release in fifomailslot_spsc_start_locked(), once it is seen active the ring is initialized
+static int fifomailslot_spsc_in_use(struct fifomailslot_dev *dev){
+    return smp_load_acquire(&dev->spsc_active);
+}
+
+static int fifomailslot_spsc_eligible(struct fifomailslot_dev *dev){
+    return dev->mode == FIFO_SLOT_MODE && dev->backpressure_policy == BACKPRESSURE_BLOCK &&
+           !READ_ONCE(dev->ttl) && !atomic_read(&dev->ttl_sessions) &&
+           !dev->session_byte_quota && !dev->session_msg_quota;
+}
+
+static int fifomailslot_spsc_sessions_ok(struct fifomailslot_dev *dev){
+    int sessions = atomic_read(&dev->no_sessions);
+
+    if (READ_ONCE(dev->spsc_requested))
+        return sessions <= 2;
+    return sessions == 2 && atomic_read(&dev->reader_sessions) == 1 && atomic_read(&dev->writer_sessions) == 1;
+}
+
+//until a stop is over the messages of the ring still count, although it is not in use anymore
+static int fifomailslot_spsc_holds_messages(struct fifomailslot_dev *dev){
+    return READ_ONCE(dev->spsc) && (READ_ONCE(dev->spsc_active) || READ_ONCE(dev->spsc_stopping));
+}
+
+//storage used by the messages in the ring, bytes_out is read first so that it never exceeds bytes_in
+static long fifomailslot_spsc_bytes(struct fifomailslot_dev *dev){
+    unsigned long bytes_out;
+    struct fifomailslot_spsc *spsc = READ_ONCE(dev->spsc);
+
+    if (!fifomailslot_spsc_holds_messages(dev))
+        return 0;
+    bytes_out = READ_ONCE(spsc->bytes_out);
+    smp_rmb();
+    return READ_ONCE(spsc->bytes_in) - bytes_out;
+}
+
+static int fifomailslot_spsc_pending(struct fifomailslot_dev *dev){
+    struct fifomailslot_spsc *spsc = READ_ONCE(dev->spsc);
+
+    if (!fifomailslot_spsc_holds_messages(dev))
+        return 0;
+    return READ_ONCE(spsc->head) != smp_load_acquire(&spsc->tail);
+}
+
+//evaluated by the producer. The acquire orders the read of the slot by the consumer before its reuse
+static int fifomailslot_spsc_has_room(struct fifomailslot_dev *dev, int size){
+    struct fifomailslot_spsc *spsc = dev->spsc;
+    unsigned long head = smp_load_acquire(&spsc->head);
+
+    if (spsc->tail - head >= SPSC_RING_SIZE)
+        return 0;
+    return (long)(spsc->bytes_in - READ_ONCE(spsc->bytes_out)) + atomic_long_read(&dev->storage_size) + size <= dev->max_storage;
+}
+
+//called holding dev->mutex
+static void fifomailslot_spsc_start_locked(struct fifomailslot_dev *dev){
+    struct fifomailslot_spsc *spsc = dev->spsc;
+
+    if (dev->spsc_stopping || !fifomailslot_spsc_eligible(dev) || atomic_read(&dev->no_msg) ||
+        !llist_empty(&dev->kernel_pending))
+        return;
+
+    //allocated the first time and kept until the module is removed, the slot stays on the queue without it
+    if (!spsc){
+        spsc = kvzalloc(sizeof(struct fifomailslot_spsc), GFP_KERNEL);
+        if (!spsc)
+            return;
+        mutex_init(&spsc->write_mutex);
+        mutex_init(&spsc->read_mutex);
+        dev->spsc = spsc;
+    }
+    smp_store_release(&dev->spsc_active, 1);
+    printk(KERN_INFO "%s: mail slot with minor number %d switched to the single producer single consumer ring\n", DEVICE_NAME, dev->minor);
+
+    //whoever sleeps on the queue goes through the ring from now on
+    wake_up_interruptible(&dev->readwq);
+    wake_up_interruptible(&dev->wq);
+}
+
+/*
+ * The ring is cleared as active under dev->mutex, but its messages are moved to the queue only
+ * after a grace period, without holding the mutex in the meantime. While spsc_stopping is set the
+ * ring cannot be started again and the writers to the queue wait for it to be clear, so that
+ * their messages do not pass the ones still in the ring.
+ */
+static void fifomailslot_spsc_stop(struct fifomailslot_dev *dev){
+    int stopping = 0;
+    struct fifomailslot_spsc *spsc = dev->spsc;
+    struct fifomailslot_data *mesg_data;
+
+    if (!READ_ONCE(dev->spsc_active) && !READ_ONCE(dev->spsc_stopping))
+        return;
+
+    mutex_lock(&dev->mutex);
+    if (dev->spsc_active){
+        WRITE_ONCE(dev->spsc_active, 0);
+        WRITE_ONCE(dev->spsc_stopping, 1);
+        stopping = 1;
+    }
+    mutex_unlock(&dev->mutex);
+
+    //somebody else is stopping it, the caller expects the messages to be in the queue on return
+    if (!stopping){
+        wait_event(dev->wq, !READ_ONCE(dev->spsc_stopping));
+        return;
+    }
+
+    //waits for the reads and writes that saw the ring active, nobody touches it afterwards
+    synchronize_rcu();
+
+    //the queue is empty, or holds only messages that were waiting for this stop to be over
+    mutex_lock(&dev->mutex);
+    for (; spsc->head != spsc->tail; spsc->head++){
+        mesg_data = spsc->ring[spsc->head % SPSC_RING_SIZE];
+        atomic_long_add(mesg_data->len, &dev->storage_size);
+        fifomailslot_enqueue_locked(dev, mesg_data);
+    }
+    spsc->head = 0;
+    spsc->tail = 0;
+    spsc->bytes_in = 0;
+    spsc->bytes_out = 0;
+    WRITE_ONCE(dev->spsc_stopping, 0);
+    mutex_unlock(&dev->mutex);
+    printk(KERN_INFO "%s: mail slot with minor number %d switched back to the queue\n", DEVICE_NAME, dev->minor);
+
+    //the sides sleeping on the ring go back to the queue, the writers to the queue go on
+    wake_up(&dev->readwq);
+    wake_up(&dev->wq);
+}
+
+//takes dev->mutex with the ring stopped, for the paths that link or walk the messages of the queue
+static void fifomailslot_lock_queue(struct fifomailslot_dev *dev){
+    while (1){
+        fifomailslot_spsc_stop(dev);
+        mutex_lock(&dev->mutex);
+        if (!dev->spsc_active && !dev->spsc_stopping)
+            return;
+        mutex_unlock(&dev->mutex);
+    }
+}
+
+//starts or stops the ring after a session has been opened or closed, or after CHANGE_SPSC_CTL
+static void fifomailslot_spsc_update(struct fifomailslot_dev *dev){
+    if (!fifomailslot_spsc_sessions_ok(dev)){
+        fifomailslot_spsc_stop(dev);
+        return;
+    }
+    mutex_lock(&dev->mutex);
+    if (!dev->spsc_active)
+        fifomailslot_spsc_start_locked(dev);
+    mutex_unlock(&dev->mutex);
+}
+
+/*
+ * Takes the first message of the ring as the consumer, the caller holds spsc->read_mutex. Returns
+ * NULL if the ring is empty or not in use, ERR_PTR(-EMSGSIZE) if the message does not fit in len
+ * bytes (it is left in the ring).
+ */
+static struct fifomailslot_data *fifomailslot_spsc_dequeue(struct fifomailslot_dev *dev, size_t len){
+    unsigned long head;
+    struct fifomailslot_spsc *spsc = dev->spsc;
+    struct fifomailslot_data *mesg_data = NULL;
+
+    rcu_read_lock();
+    head = spsc->head;
+    if (READ_ONCE(dev->spsc_active) && head != smp_load_acquire(&spsc->tail)){
+        mesg_data = spsc->ring[head % SPSC_RING_SIZE];
+        if (mesg_data->len > len)
+            mesg_data = ERR_PTR(-EMSGSIZE);
+        else{
+            WRITE_ONCE(spsc->bytes_out, spsc->bytes_out + mesg_data->len);
+            smp_store_release(&spsc->head, head + 1);
+        }
+    }
+    rcu_read_unlock();
+    return mesg_data;
+}
+
+//called after a message has been taken from the ring, a writer sleeps only on a full ring
+static void fifomailslot_spsc_consumed(struct fifomailslot_dev *dev){
+    if (wq_has_sleeper(&dev->wq))
+        wake_up_interruptible(&dev->wq);
+    fifomailslot_notify_space(dev);
+}
+
+/*
+ * fifomailslot_try_dequeue() on a slot using the ring: the in-kernel API, drain and group receive
+ * consume from it as the reader does. Returns 0 if the ring is not in use.
+ */
+static int fifomailslot_spsc_try_dequeue(struct fifomailslot_dev *dev, char *buf, size_t len){
+    int ret;
+    struct fifomailslot_data *mesg_data;
+
+    if (!fifomailslot_spsc_in_use(dev))
+        return 0;
+
+    //a blocked reader sleeps holding the mutex, this is a try
+    if (!mutex_trylock(&dev->spsc->read_mutex))
+        return -EAGAIN;
+    mesg_data = fifomailslot_spsc_dequeue(dev, len);
+    mutex_unlock(&dev->spsc->read_mutex);
+
+    if (IS_ERR(mesg_data))
+        return -EMSGSIZE;
+    if (!mesg_data)
+        return READ_ONCE(dev->spsc_active) ? -EAGAIN : 0;
+
+    ret = mesg_data->len;
+    memcpy(buf, mesg_data->payload, ret);
+    fifomailslot_free_message(mesg_data);
+    fifomailslot_spsc_consumed(dev);
+    return ret;
+}
+
+/*
+ * Queues a message whose payload and len are set. Returns len, a negative error (the message is
+ * freed) or 0 if the ring is not in use anymore: the message is left to the caller for the queue.
+ */
+static int fifomailslot_spsc_push(struct fifomailslot_session *session, struct fifomailslot_data *mesg_data, int blocking_write){
+    //once published the message may be consumed and freed at any time
+    int len = mesg_data->len;
+    int pushed = 0;
+    int err = 0;
+    long ret;
+    unsigned long tail = 0;
+    struct fifomailslot_dev *dev = session->dev;
+    struct fifomailslot_spsc *spsc = dev->spsc;
+    long timeout = fifomailslot_timeout(session->write_timeout);
+
+    if (session->message_ttl || !fifomailslot_spsc_eligible(dev)){
+        fifomailslot_spsc_stop(dev);
+        return 0;
+    }
+
+    if (blocking_write){
+        if (mutex_lock_interruptible(&spsc->write_mutex)){
+            fifomailslot_free_message(mesg_data);
+            return -ERESTARTSYS;
+        }
+    }
+    else if (!mutex_trylock(&spsc->write_mutex)){
+        fifomailslot_free_message(mesg_data);
+        return -EAGAIN;
+    }
+
+    mesg_data->next = NULL;
+    mesg_data->owner = NULL;
+    mesg_data->expires = 0;
+
+    while (1){
+        rcu_read_lock();
+        if (!READ_ONCE(dev->spsc_active)){
+            rcu_read_unlock();
+            break;
+        }
+        if (fifomailslot_spsc_has_room(dev, mesg_data->len)){
+            tail = spsc->tail;
+            spsc->ring[tail % SPSC_RING_SIZE] = mesg_data;
+            WRITE_ONCE(spsc->bytes_in, spsc->bytes_in + mesg_data->len);
+            smp_store_release(&spsc->tail, tail + 1);
+            rcu_read_unlock();
+            pushed = 1;
+            break;
+        }
+        rcu_read_unlock();
+
+        if (!blocking_write){
+            err = -EAGAIN;
+            break;
+        }
+        if (session->busy_poll_write &&
+            fifomailslot_busy_poll((u64)session->busy_poll_usecs * NSEC_PER_USEC,
+                                   fifomailslot_spsc_has_room(dev, mesg_data->len) || !READ_ONCE(dev->spsc_active)))
+            continue;
+        ret = wait_event_interruptible_timeout(dev->wq, fifomailslot_spsc_has_room(dev, mesg_data->len) || !READ_ONCE(dev->spsc_active), timeout);
+        if (ret < 0){
+            err = -ERESTARTSYS;
+            break;
+        }
+        if (ret == 0){
+            printk(KERN_INFO "%s: write, process %d timed out\n", DEVICE_NAME, current->pid);
+            err = -ETIMEDOUT;
+            break;
+        }
+        timeout = ret;
+    }
+    mutex_unlock(&spsc->write_mutex);
+
+    if (err){
+        fifomailslot_free_message(mesg_data);
+        return err;
+    }
+    if (!pushed)
+        return 0;
+
+    //the reader sleeps only on an empty ring: it has to be woken only if it consumed up to this message
+    smp_mb();
+    if (READ_ONCE(spsc->head) == tail && wq_has_sleeper(&dev->readwq))
+        wake_up_interruptible(&dev->readwq);
+    fifomailslot_notify_arrival(dev);
+    if (atomic_read(&dev->busy_poll_sessions))
+        fifomailslot_record_arrival(dev);
+
+    session->stats.msgs_written++;
+    session->stats.bytes_written += len;
+    return len;
+}
+
+//returns 0 if the ring is not in use anymore and the write has to go through the queue
+static ssize_t fifomailslot_spsc_write(struct fifomailslot_session *session, const char *buff, size_t len, int blocking_write){
+    int ret;
+    struct fifomailslot_data *mesg_data;
+
+    if (len > session->max_data_unit_size || len == 0){
+        printk(KERN_ERR "%s: ERROR write of a message with too high size, the len was %zu but the maximum data unit size is %ld",DEVICE_NAME, len, session->max_data_unit_size);
+        return -EMSGSIZE;
+    }
+
+    mesg_data = fifomailslot_alloc_message(session->dev, len, GFP_KERNEL);
+    if (!mesg_data)
+        return -ENOMEM;
+    if (copy_from_user(mesg_data->payload, buff, len)){
+        printk(KERN_ERR "%s: ERROR in the copy_from_user()",DEVICE_NAME);
+        fifomailslot_free_message(mesg_data);
+        return -1;
+    }
+    mesg_data->len = len;
+
+    ret = fifomailslot_spsc_push(session, mesg_data, blocking_write);
+    if (!ret)
+        fifomailslot_free_message(mesg_data);
+    return ret;
+}
+
+//returns 0 if the ring is not in use anymore and the read has to go through the queue
+static ssize_t fifomailslot_spsc_read(struct fifomailslot_session *session, char *buff, size_t len, int blocking_read){
+    int mesg_len;
+    int err = 0;
+    long ret;
+    struct fifomailslot_data *mesg_data = NULL;
+    struct fifomailslot_dev *dev = session->dev;
+    struct fifomailslot_spsc *spsc = dev->spsc;
+    long timeout = fifomailslot_timeout(session->read_timeout);
+
+    if (blocking_read){
+        if (mutex_lock_interruptible(&spsc->read_mutex))
+            return -ERESTARTSYS;
+    }
+    else if (!mutex_trylock(&spsc->read_mutex))
+        return -EAGAIN;
+
+    while (1){
+        mesg_data = fifomailslot_spsc_dequeue(dev, len);
+        if (IS_ERR(mesg_data)){
+            printk(KERN_ERR "%s: read, the buffer is too small\n", DEVICE_NAME);
+            err = -1;
+            break;
+        }
+        if (mesg_data || !READ_ONCE(dev->spsc_active))
+            break;
+
+        if (!blocking_read){
+            err = -EAGAIN;
+            break;
+        }
+        if (session->busy_poll_usecs &&
+            fifomailslot_busy_poll(fifomailslot_read_poll_budget(session), fifomailslot_spsc_pending(dev) || !READ_ONCE(dev->spsc_active)))
+            continue;
+        ret = wait_event_interruptible_timeout(dev->readwq, fifomailslot_spsc_pending(dev) || !READ_ONCE(dev->spsc_active), timeout);
+        if (ret < 0){
+            err = -ERESTARTSYS;
+            break;
+        }
+        if (ret == 0){
+            printk(KERN_INFO "%s: read, process %d timed out\n", DEVICE_NAME, current->pid);
+            err = -ETIMEDOUT;
+            break;
+        }
+        timeout = ret;
+    }
+    mutex_unlock(&spsc->read_mutex);
+
+    if (err)
+        return err;
+    if (!mesg_data)
+        return 0;
+    fifomailslot_spsc_consumed(dev);
+
+    mesg_len = mesg_data->len;
+    if (copy_to_user(buff, mesg_data->payload, mesg_len)){
+        printk(KERN_ERR "%s: ERROR in the copy_to_user()",DEVICE_NAME);
+        fifomailslot_free_message(mesg_data);
+        return -1;
+    }
+    fifomailslot_free_message(mesg_data);
+
+    fifomailslot_track_consumer(dev);
+    session->stats.msgs_read++;
+    session->stats.bytes_read += mesg_len;
+    return mesg_len;
+}
+
 
 int fifomailslot_init(void){
 	major = register_chrdev(0, DEVICE_NAME, &fops);
@@ -404,20 +3149,47 @@ int fifomailslot_init(void){
 
 void fifomailslot_cleanup(void){
     int i;
+    int cpu;
     struct fifomailslot_dev* dev;
     struct fifomailslot_data* msg_to_delete;
+    struct fifomailslot_data* next_msg;
 
     for(i = 0; i< MAX_MINOR_NUMBER; i++){
         dev = mailslot_devices[i];
         if (dev){
+            cancel_delayed_work_sync(&dev->expire_work);
+            cancel_work_sync(&dev->kernel_work);
+            llist_for_each_entry_safe(msg_to_delete, next_msg, llist_del_all(&dev->kernel_pending), kernel_node){
+                fifomailslot_free_message(msg_to_delete);
+            }
+            if (dev->notify_ctx)
+                eventfd_ctx_put(dev->notify_ctx);
             msg_to_delete = dev->head;
             while(msg_to_delete) {
                 dev->head = dev->head->next;
-                kfree(msg_to_delete->payload);
-                kfree(msg_to_delete);
+                fifomailslot_free_message(msg_to_delete);
                 msg_to_delete = dev->head;
             }
-            kfree(dev);
+            if (dev->shards){
+                for_each_possible_cpu(cpu){
+                    msg_to_delete = per_cpu_ptr(dev->shards, cpu)->head;
+                    while(msg_to_delete) {
+                        next_msg = msg_to_delete->next;
+                        fifomailslot_free_message(msg_to_delete);
+                        msg_to_delete = next_msg;
+                    }
+                }
+                free_percpu(dev->shards);
+                percpu_counter_destroy(&dev->shard_storage_size);
+            }
+            if (dev->spsc){
+                for (; dev->spsc->head != dev->spsc->tail; dev->spsc->head++)
+                    fifomailslot_free_message(dev->spsc->ring[dev->spsc->head % SPSC_RING_SIZE]);
+                kvfree(dev->spsc);
+            }
+            //every message has been freed, this drops the last reference to the chunk being filled
+            fifomailslot_disable_arena(dev);
+            fifomailslot_free_dev(dev);
         }
     }
 
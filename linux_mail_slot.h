@@ -1,12 +1,16 @@
 #ifndef LINUX_MAIL_SLOT_HEADER
 #define LINUX_MAIL_SLOT_HEADER
 
+#include "linux_mail_slot_api.h"      /* the part other modules include */
+
 #define DEVICE_NAME "FIFO_MAIL_SLOT"  /* Device file name in /dev/ - not mandatory  */
 #define MODNAME "FIFO_MAIL_SLOT"
 
 #define MAX_MINOR_NUMBER 256
 #define MAX_DATA_UNIT_SIZE 128
 #define MAX_STORAGE (1<<20)
+#define SHARD_STORAGE_BATCH (16*MAX_DATA_UNIT_SIZE)   /* bytes a cpu accumulates before touching the shared storage counter */
+#define CONSUMER_NODE_HYSTERESIS 64     /* consecutive reads from another node before the consumer node follows them */
 
 #define CHANGE_WRITE_BLOCKING_MODE_CTL 3
 #define CHANGE_READ_BLOCKING_MODE_CTL 4
@@ -15,27 +19,279 @@
 #define GET_FREESPACE_SIZE_CTL 7
 #define GET_WRITE_BLOCKING_MODE_CTL 8
 #define GET_READ_BLOCKING_MODE_CTL 9
+#define CHANGE_SLOT_MODE_CTL 10
+#define GET_SLOT_MODE_CTL 11
+#define CHANGE_SLOW_SUBSCRIBER_POLICY_CTL 12
+#define GET_SLOW_SUBSCRIBER_POLICY_CTL 13
+#define GET_SUBSCRIBER_DROPPED_CTL 14
+#define CHANGE_BUSY_POLL_CTL 15
+#define GET_BUSY_POLL_CTL 16
+#define CHANGE_WRITE_BUSY_POLL_CTL 17
+#define GET_WRITE_BUSY_POLL_CTL 18
+#define CHANGE_READ_TIMEOUT_CTL 19
+#define GET_READ_TIMEOUT_CTL 20
+#define CHANGE_WRITE_TIMEOUT_CTL 21
+#define GET_WRITE_TIMEOUT_CTL 22
+#define CHANGE_SLOT_TTL_CTL 23
+#define GET_SLOT_TTL_CTL 24
+#define CHANGE_MESSAGE_TTL_CTL 25
+#define GET_MESSAGE_TTL_CTL 26
+#define GET_EXPIRED_CTL 27
+#define CHANGE_BACKPRESSURE_POLICY_CTL 28
+#define GET_BACKPRESSURE_POLICY_CTL 29
+#define GET_OVERWRITTEN_CTL 30
+#define CHANGE_SESSION_BYTE_QUOTA_CTL 31
+#define GET_SESSION_BYTE_QUOTA_CTL 32
+#define CHANGE_SESSION_MSG_QUOTA_CTL 33
+#define GET_SESSION_MSG_QUOTA_CTL 34
+#define GET_QUEUED_BYTES_CTL 35
+#define GET_QUEUED_MSGS_CTL 36
+#define GET_SESSION_STATS_CTL 37
+#define GROUP_RECEIVE_CTL 38
+#define REGISTER_EVENTFD_CTL 39
+#define UNREGISTER_EVENTFD_CTL 40
+#define CHANGE_CONSUMER_NODE_CTL 41
+#define GET_CONSUMER_NODE_CTL 42
+#define GET_NODE_STATS_CTL 43
+#define DRAIN_CTL 44
+#define SNAPSHOT_CTL 45
+#define RESTORE_CTL 46
+#define CHANGE_ARENA_CTL 47
+#define GET_ARENA_CTL 48
+#define GET_ARENA_CHUNKS_CTL 49
+#define CHANGE_SPSC_CTL 50
+#define GET_SPSC_CTL 51
+
+#define EXPIRE_SCAN_INTERVAL_MSECS 100     /* period of the scan that reclaims expired messages */
+
+#define MAX_BUSY_POLL_USECS 10000
+
+#define ARENA_MAX_MESSAGE_SIZE 64       /* larger messages are never allocated from the arena */
+#define ARENA_ALIGN sizeof(long)
+
+#define SPSC_RING_SIZE 4096             /* messages in the ring of a point-to-point slot, a power of two */
+
+/* slot modes */
+#define FIFO_SLOT_MODE 0            /* every message is delivered to exactly one reader */
+#define FANOUT_SLOT_MODE 1          /* every message is delivered to every reading session */
+#define SHARDED_SLOT_MODE 2         /* one queue per cpu, only the order among the messages of a session is kept */
+#define READ_MODE_CHANGED (-EXDEV)  /* internal: the slot mode changed while a reader waited, it dispatches again */
+
+/* what a fan-out publisher does when a slow subscriber keeps the storage full */
+#define SLOW_SUBSCRIBER_BLOCK 0         /* wait for the subscriber to catch up */
+#define SLOW_SUBSCRIBER_DROP 1          /* the subscriber loses its oldest messages */
+#define SLOW_SUBSCRIBER_DISCONNECT 2    /* the subscriber is detached, its next read fails with ECONNRESET */
+
+/* what a writer does when there is not enough free space */
+#define BACKPRESSURE_BLOCK 0            /* wait, or fail with EAGAIN if non blocking */
+#define BACKPRESSURE_OVERWRITE 1        /* evict the oldest messages until the new one fits, writers never wait */
+
+/* events signalled on the eventfd registered with REGISTER_EVENTFD_CTL */
+#define NOTIFY_NOT_EMPTY 1              /* the slot went from empty to non empty */
+#define NOTIFY_SPACE 2                  /* the free space went from below to at least the watermark */
+
+/* bits of fifomailslot_dev.notify_armed, an event is signalled once and then re-armed by the opposite transition */
+#define NOTIFY_NOT_EMPTY_ARMED 0
+#define NOTIFY_SPACE_ARMED 1
 
 
 struct fifomailslot_data {
 	char *payload;
 	int len;
-	struct fifomailslot_data *next;
+	int refcount:30;                /* fan-out mode: subscribers that still have to read it */
+	unsigned int arena:1;           /* carved with its payload out of an arena chunk, the page it lies in */
+	unsigned int shard_charged:1;   /* in-kernel API: the space was reserved in the per cpu counter */
+	unsigned long expires;          /* jiffies after which the message is dropped, 0 if it never expires */
+	struct fifomailslot_session *owner;     /* session charged for the message, NULL if it has been closed */
+	/* a message waits on the llist of the in-kernel API only before it is linked in a queue */
+	union {
+		struct fifomailslot_data *next;
+		struct llist_node kernel_node;  /* written from atomic context, waiting to be linked by kernel_work */
+	};
+};
+
+/* a page of the small message arena, the messages are carved after this header */
+struct fifomailslot_chunk {
+    atomic_t refcount;                  /* messages in the chunk, plus one while the arena fills it */
+    unsigned int used;                  /* bytes handed out, header included */
+    struct fifomailslot_dev *dev;
+};
+
+/* counters of a session, returned by GET_SESSION_STATS_CTL */
+struct fifomailslot_session_stats {
+    unsigned long msgs_written;
+    unsigned long bytes_written;
+    unsigned long msgs_read;
+    unsigned long bytes_read;
 };
 
+/* argument of REGISTER_EVENTFD_CTL */
+struct fifomailslot_eventfd {
+    int fd;                     /* eventfd of the caller, it replaces the one previously registered on the slot */
+    int events;                 /* NOTIFY_NOT_EMPTY and/or NOTIFY_SPACE */
+    long watermark;             /* NOTIFY_SPACE: free bytes that make the slot writable again */
+};
+
+/* argument of GET_NODE_STATS_CTL: node is filled by the caller, the counters by the driver */
+struct fifomailslot_node_stats {
+    int node;
+    unsigned long msgs;         /* messages allocated on the node since the slot was created */
+    unsigned long bytes;
+};
+
+/*
+ * Format of the buffers of DRAIN_CTL, SNAPSHOT_CTL and RESTORE_CTL: a fifomailslot_dump_header
+ * followed by count records, each one a fifomailslot_dump_record followed by len bytes of payload,
+ * without any padding. Integers are in the byte order of the host. The messages are in queue order
+ * (in sharded mode, queue by queue). The remaining ttl of a message is not saved, restored messages
+ * get the ttl of the slot they are restored into.
+ */
+#define FIFOMAILSLOT_DUMP_MAGIC 0x44534d46      /* "FMSD" in memory on little endian hosts */
+#define FIFOMAILSLOT_DUMP_VERSION 1
+#define FIFOMAILSLOT_DUMP_TRUNCATED 1           /* the buffer was full, the slot holds more messages */
+
+struct fifomailslot_dump_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int flags;
+    unsigned int count;         /* records following the header */
+    unsigned int size;          /* bytes of the whole dump, header included */
+};
+
+struct fifomailslot_dump_record {
+    unsigned int len;
+};
+
+/* argument of DRAIN_CTL, SNAPSHOT_CTL and RESTORE_CTL */
+struct fifomailslot_dump {
+    char *buff;
+    size_t len;
+};
+
+/* argument of GROUP_RECEIVE_CTL */
+struct fifomailslot_group_receive {
+    int *minors;                /* slots to receive from, none of them may be in fan-out mode */
+    int no_minors;
+    char *buff;                 /* filled with one fifomailslot_record per message */
+    size_t len;
+    int max_msgs;
+};
+
+/*
+ * A message received from a group: the header is followed by len bytes of payload and by padding
+ * up to the next 4 bytes boundary, where the next record starts.
+ */
+struct fifomailslot_record {
+    int minor;
+    int len;
+};
+#define FIFOMAILSLOT_RECORD_SIZE(len) (sizeof(struct fifomailslot_record) + (((len) + 3) & ~3))
+
+/*
+ * Ring of a slot with one writer and one reader session. Each index is written by one side only
+ * and published with release semantics, so the two sides never share a lock; the mutexes only
+ * serialize the threads of the same session. Storage used by the ring is bytes_in - bytes_out.
+ */
+struct fifomailslot_spsc {
+    unsigned long tail ____cacheline_aligned_in_smp;    /* producer side */
+    unsigned long bytes_in;
+    struct mutex write_mutex;
+    unsigned long head ____cacheline_aligned_in_smp;    /* consumer side */
+    unsigned long bytes_out;
+    struct mutex read_mutex;
+    struct fifomailslot_data *ring[SPSC_RING_SIZE] ____cacheline_aligned_in_smp;
+};
+
+/* sharded mode: the queue of a single cpu */
+struct fifomailslot_shard {
+    spinlock_t lock;
+    struct fifomailslot_data *head, *tail;
+};
+
+/*
+ * The fields written by every message (queue, locks, counters) are kept apart from the read mostly
+ * configuration, so that enqueues and dequeues do not keep invalidating the cache line every
+ * operation reads the configuration from.
+ */
 struct fifomailslot_dev {
 	struct fifomailslot_data *head, *tail;
 	struct mutex mutex;
 	struct semaphore readsem;
-	int minor;
-	int blocking_write;
-    int blocking_read;
-	long max_storage;
-    long max_data_unit_size;
 	atomic_t no_msg;
 	atomic_long_t storage_size;
-	atomic_t no_sessions;
     wait_queue_head_t wq;
+    wait_queue_head_t readwq;
+    int active_writers;                 /* sessions with queued messages */
+    u64 last_arrival_ns;
+    u64 avg_interarrival_ns;
+    int consumer_candidate;             /* node the last reads not on consumer_node came from */
+    int candidate_reads;                /* consecutive reads from consumer_candidate */
+
+    /* read mostly */
+	int minor ____cacheline_aligned_in_smp;
+    int mode;
+	long max_storage;
+    int slow_subscriber_policy;
+    int backpressure_policy;
+    unsigned long ttl;                  /* milliseconds a message lives if its writer did not choose, 0 forever */
+    long session_byte_quota;            /* bytes a session may have queued, 0 for no limit */
+    int session_msg_quota;              /* messages a session may have queued, 0 for no limit */
+    atomic_t busy_poll_sessions;        /* arrivals are timed only while somebody busy polls */
+    atomic_t waiting_within_share;      /* writers waiting for space while within their fair share */
+    struct fifomailslot_shard __percpu *shards;   /* allocated the first time the slot becomes sharded */
+    int consumer_node;                  /* node the messages are allocated on, always a valid one: the slot's own at first */
+    int track_consumer;                 /* consumer_node follows the last reader instead of being set by ioctl */
+    struct fifomailslot_node_stats __percpu *node_stats;  /* one entry per node on every cpu, node is unused */
+    int arena_enabled;
+    int spsc_active;                    /* reads and writes go through the ring */
+    struct fifomailslot_spsc *spsc;     /* allocated the first time the ring is used */
+
+    /* rarely written */
+	atomic_t no_sessions ____cacheline_aligned_in_smp;
+    struct list_head subscribers;
+    struct percpu_counter shard_storage_size;
+    atomic_long_t expired;
+    atomic_long_t overwritten;
+    struct delayed_work expire_work;
+    spinlock_t notify_lock;             /* protects the registration, the eventfd is signalled holding it */
+    struct eventfd_ctx *notify_ctx;     /* NULL if nobody registered */
+    struct fifomailslot_session *notify_owner;  /* the registration goes away when this session is closed */
+    int notify_events;
+    long notify_watermark;
+    unsigned long notify_armed;
+    struct llist_head kernel_pending;   /* messages written from atomic context, in reverse order */
+    struct work_struct kernel_work;
+    spinlock_t arena_lock;              /* irq safe, messages are allocated by the in-kernel API too */
+    struct fifomailslot_chunk *arena;   /* chunk being filled, NULL if none */
+    atomic_t arena_chunks;              /* chunks not yet given back to the page allocator */
+    atomic_t reader_sessions;           /* sessions opened for reading, writing */
+    atomic_t writer_sessions;
+    int spsc_requested;                 /* CHANGE_SPSC_CTL: use the ring whenever at most two sessions are open */
+    int spsc_stopping;                  /* the ring is not active but its messages are not in the queue yet */
+    atomic_t ttl_sessions;              /* sessions with a message ttl of their own, which the ring cannot keep */
+};
+
+/* per open file state, stored in file->private_data */
+struct fifomailslot_session {
+    struct fifomailslot_dev *dev;
+    int blocking_write;                 /* both overridden by O_NONBLOCK */
+    int blocking_read;
+    long max_data_unit_size;
+    unsigned long read_timeout;         /* milliseconds a blocking read waits for a message, 0 to wait forever */
+    unsigned long write_timeout;        /* milliseconds a blocking write waits for space, 0 to wait forever */
+    unsigned int busy_poll_usecs;       /* how long a blocking operation spins before sleeping, 0 to sleep at once */
+    int busy_poll_write;                /* writers waiting for space spin too */
+    unsigned long message_ttl;          /* milliseconds the messages written by the session live, 0 for the slot ttl */
+    int shard_cpu;                      /* sharded mode: queue used by the writes of this session, -1 if not chosen yet */
+    struct fifomailslot_session_stats stats;
+    struct list_head subscriber_list;
+    struct fifomailslot_data *cursor;   /* fan-out mode: next message to read, NULL if up to date */
+    int subscribed;
+    int disconnected;
+    long dropped;
+    long queued_bytes;                  /* storage used by the messages of the session, protected by dev->mutex */
+    int queued_msgs;
+    int group_next;                     /* group receive: index of the slot to serve first */
 };
 
 static int fifomailslot_open(struct inode *, struct file *);
@@ -43,7 +299,78 @@ static int fifomailslot_release(struct inode *, struct file *);
 static ssize_t fifomailslot_write(struct file *, const char *, size_t, loff_t *);
 static ssize_t fifomailslot_read(struct file * , char * , size_t , loff_t * );
 static long fifomailslot_ioctl (struct file *filp, unsigned int param1, unsigned long param2);
+static struct fifomailslot_dev *fifomailslot_alloc_dev(void);
+static void fifomailslot_free_dev(struct fifomailslot_dev *dev);
 void setup_fifomailslot(struct fifomailslot_dev *dev, int minor);
 long get_freespace(struct fifomailslot_dev * dev);
-static int fifomailslot_wait_event_interruptible(struct fifomailslot_dev *dev, int required_space, struct fifomailslot_data * mesg_data, char* payload);
+static ssize_t fifomailslot_fanout_read(struct fifomailslot_session *session, char *buff, size_t len, int blocking_read);
+static void fifomailslot_fanout_publish(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data);
+static void fifomailslot_fanout_make_room(struct fifomailslot_dev *dev, int required_space);
+static void fifomailslot_unsubscribe(struct fifomailslot_session *session);
+static int fifomailslot_setup_shards(struct fifomailslot_dev *dev);
+static ssize_t fifomailslot_sharded_write(struct fifomailslot_session *session, const char *buff, size_t len, int blocking_write);
+static ssize_t fifomailslot_sharded_read(struct fifomailslot_session *session, char *buff, size_t len, int blocking_read);
+static int fifomailslot_is_empty(struct fifomailslot_dev *dev);
+static int fifomailslot_sharded_pending(struct fifomailslot_dev *dev);
+static struct fifomailslot_data *fifomailslot_sharded_dequeue(struct fifomailslot_dev *dev, size_t len);
+static struct fifomailslot_data *fifomailslot_alloc_message(struct fifomailslot_dev *dev, size_t len, gfp_t gfp);
+static void fifomailslot_free_message(struct fifomailslot_data *mesg_data);
+static struct fifomailslot_data *fifomailslot_arena_alloc(struct fifomailslot_dev *dev, size_t len, gfp_t gfp);
+static void fifomailslot_chunk_put(struct fifomailslot_chunk *chunk);
+static struct fifomailslot_chunk *fifomailslot_chunk_of(struct fifomailslot_data *mesg_data);
+static void fifomailslot_disable_arena(struct fifomailslot_dev *dev);
+static void fifomailslot_track_consumer(struct fifomailslot_dev *dev);
+static long fifomailslot_get_node_stats(struct fifomailslot_dev *dev, struct fifomailslot_node_stats __user *arg);
+static int fifomailslot_read_ready(struct fifomailslot_dev *dev, int *token);
+static void fifomailslot_give_back_token(struct fifomailslot_dev *dev);
+static void fifomailslot_enqueue_locked(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data);
+static void fifomailslot_sharded_enqueue(struct fifomailslot_dev *dev, int cpu, struct fifomailslot_data *mesg_data);
+static void fifomailslot_kernel_work(struct work_struct *work);
+static int fifomailslot_dequeue_locked(struct fifomailslot_dev *dev, char *buf, size_t len);
+static int fifomailslot_try_dequeue(struct fifomailslot_dev *dev, char *buf, size_t len);
+static long fifomailslot_group_receive(struct file *filp, struct fifomailslot_group_receive __user *arg);
+static long fifomailslot_dump(struct fifomailslot_dev *dev, struct fifomailslot_dump __user *arg, int drain);
+static long fifomailslot_restore(struct fifomailslot_dev *dev, struct fifomailslot_dump __user *arg);
+static struct fifomailslot_data *fifomailslot_dump_messages(struct fifomailslot_dev *dev, char *buf, size_t size, unsigned int count,
+                                                            struct fifomailslot_data **last, long *total);
+static void fifomailslot_free_messages(struct fifomailslot_data *first);
+static int fifomailslot_dump_reserve(struct fifomailslot_dev *dev, long total);
+static void fifomailslot_requeue(struct fifomailslot_dev *dev, char *buf, size_t size, unsigned int count, int mode);
+static long fifomailslot_timeout(unsigned long msecs);
+static unsigned long fifomailslot_expiry(struct fifomailslot_session *session);
+static void fifomailslot_remove_message(struct fifomailslot_dev *dev, struct fifomailslot_data *prev, struct fifomailslot_data *mesg_data);
+static int fifomailslot_expire(struct fifomailslot_dev *dev, int whole_queue);
+static void fifomailslot_expire_work(struct work_struct *work);
+static void fifomailslot_overwrite_oldest(struct fifomailslot_dev *dev, int required_space);
+static int fifomailslot_sharded_overwrite_oldest(struct fifomailslot_dev *dev);
+static void fifomailslot_charge(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data);
+static void fifomailslot_uncharge(struct fifomailslot_dev *dev, struct fifomailslot_data *mesg_data);
+static void fifomailslot_leave_share(struct fifomailslot_dev *dev);
+static void fifomailslot_disown(struct fifomailslot_session *session);
+static int fifomailslot_over_quota(struct fifomailslot_session *session, int required_space);
+static int fifomailslot_may_write(struct fifomailslot_session *session, int required_space);
+static void fifomailslot_overwrite_own(struct fifomailslot_session *session, int required_space);
+static long fifomailslot_register_eventfd(struct fifomailslot_session *session, struct fifomailslot_eventfd __user *arg);
+static void fifomailslot_unregister_eventfd(struct fifomailslot_dev *dev, struct fifomailslot_session *owner);
+static void fifomailslot_notify_arrival(struct fifomailslot_dev *dev);
+static void fifomailslot_notify_space(struct fifomailslot_dev *dev);
+static void fifomailslot_record_arrival(struct fifomailslot_dev *dev);
+static u64 fifomailslot_read_poll_budget(struct fifomailslot_session *session);
+static int fifomailslot_spsc_in_use(struct fifomailslot_dev *dev);
+static void fifomailslot_spsc_update(struct fifomailslot_dev *dev);
+static void fifomailslot_spsc_stop(struct fifomailslot_dev *dev);
+static void fifomailslot_spsc_start_locked(struct fifomailslot_dev *dev);
+static void fifomailslot_lock_queue(struct fifomailslot_dev *dev);
+static int fifomailslot_spsc_eligible(struct fifomailslot_dev *dev);
+static int fifomailslot_spsc_sessions_ok(struct fifomailslot_dev *dev);
+static int fifomailslot_spsc_holds_messages(struct fifomailslot_dev *dev);
+static struct fifomailslot_data *fifomailslot_spsc_dequeue(struct fifomailslot_dev *dev, size_t len);
+static void fifomailslot_spsc_consumed(struct fifomailslot_dev *dev);
+static int fifomailslot_spsc_try_dequeue(struct fifomailslot_dev *dev, char *buf, size_t len);
+static int fifomailslot_spsc_push(struct fifomailslot_session *session, struct fifomailslot_data *mesg_data, int blocking_write);
+static ssize_t fifomailslot_spsc_write(struct fifomailslot_session *session, const char *buff, size_t len, int blocking_write);
+static ssize_t fifomailslot_spsc_read(struct fifomailslot_session *session, char *buff, size_t len, int blocking_read);
+static long fifomailslot_spsc_bytes(struct fifomailslot_dev *dev);
+static int fifomailslot_spsc_pending(struct fifomailslot_dev *dev);
+static int fifomailslot_wait_event_interruptible(struct fifomailslot_session *session, int required_space, int blocking_write, struct fifomailslot_data * mesg_data);
 #endif
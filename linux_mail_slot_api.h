@@ -0,0 +1,18 @@
+#ifndef LINUX_MAIL_SLOT_API_HEADER
+#define LINUX_MAIL_SLOT_API_HEADER
+
+#include <linux/types.h>
+#include <linux/gfp.h>
+
+/*
+ * In-kernel API for other modules, see the comment before fifomailslot_lookup(). The slot is opaque
+ * to them. A slot is never freed before this module is removed, and this module cannot be removed
+ * while a module using these symbols is loaded.
+ */
+struct fifomailslot_dev;
+
+struct fifomailslot_dev *fifomailslot_lookup(int minor);
+ssize_t fifomailslot_kernel_write(struct fifomailslot_dev *dev, const void *buf, size_t len, gfp_t gfp);
+ssize_t fifomailslot_kernel_read(struct fifomailslot_dev *dev, void *buf, size_t len);
+
+#endif